@@ -4,9 +4,25 @@
 #include <ARCbus.h>
 #include <MSP430.h>
   
-//Address range for ERROR data on the SD card
+//default address range for ERROR data on the SD card, a different range can be given to error_init_region
+//the region starts with the superblock and the flight recorder snapshots, the rest of the region holds the error log
+//the default region is the same 65 blocks that have always been used so the default log is 48 blocks
 enum{ERR_ADDR_START=0,ERR_ADDR_END=64};
 
+//largest error log in blocks, block numbers must stay in sequence for one trip around the log
+enum{ERR_ADDR_MAX_BLOCKS=0x8000};
+
+//number of flight recorder snapshots kept at the start of the error region, one block per snapshot
+enum{ERR_SNAP_SLOTS=16};
+
+//layout of an error region that begins at start, these are used by the library and by tools that read SD card images
+//address of the superblock that holds the log epoch
+#define ERR_SUPER_BLOCK(start)        (start)
+//address of a snapshot slot
+#define ERR_SNAP_BLOCK(start,slot)    ((start)+1+(slot))
+//address of the first error log block
+#define ERR_LOG_BLOCK(start)          ((start)+1+ERR_SNAP_SLOTS)
+
 //error codes for 
 enum{ERR_TABLE_FULL=1,ERR_INVALID_RANGE,ERR_OVERLAP};
 
@@ -32,11 +48,35 @@ typedef struct{
   ticker time;
 }ERROR_DAT;
 
+//flag set in the error count of a SPI_ERROR_DAT packet when errors are encoded
+//encoded packets have the base time after the count followed by the errors encoded as in SD card blocks
+enum{ERR_SPI_COMPACT=0x8000};
+
+//flag set in the error count of a SPI_ERROR_DAT packet that is part of a stream
+//stream packets are encoded and have a sequence number between the count and the base time
+//ERR_SPI_LAST is set in the sequence number of the last packet of the stream
+enum{ERR_SPI_STREAM=0x4000,ERR_SPI_LAST=0x8000};
+
+//flag set in the error count of stream packets sent by an error forwarder
+//a board can forward errors while it sends an export, the two streams have separate sequence numbers
+enum{ERR_SPI_FORWARD=0x2000};
+
 //setup for error reporting
 void error_init(void);
 
+//setup for error reporting with the error region in SD card blocks start to end
+//the region holds the superblock and the flight recorder snapshots followed by the error log, see ERR_LOG_BLOCK
+//returns ERR_INVALID_RANGE and uses the default range if the range is not valid
+int error_init_region(unsigned long start,unsigned long end);
+
 //Start error recording
-void error_recording_start(void);
+//errors kept in RAM through a warm reset are written to the SD card when recording starts
+//returns RET_SUCCESS or an error from the SD card or ERR_BUSY if the bus buffer could not be used
+//when recording could not start errors stay in RAM and error_recording_start can be called again
+int error_recording_start(void);
+
+//get the number of warm resets that the errors in RAM have been kept through, zero if they were cleared at startup
+unsigned short error_reset_count(void);
 
 //user function to decode errors
 typedef const char* (*ERR_DECODE)(char buf[150],unsigned short source,int err, unsigned short argument);
@@ -47,23 +87,428 @@ unsigned char set_error_level(unsigned char lev);
 //get error level
 unsigned char get_error_level(void);
 
-//report an error
+//constants that size public structs are fixed when the library is built, unlike the #ifndef options an application
+//can't change them because its structs would no longer match the prebuilt library
+//number of entries in the per source level table, sizes ERR_SRC_LEVELS, sources past the end of the table use the error level
+#define ERR_SRC_LEVEL_NUM     (256)
+//sources are grouped by shifting right, each group of 1<<ERR_SRC_LEVEL_SHIFT sources shares a table entry
+#define ERR_SRC_LEVEL_SHIFT   (0)
+
+//saved copy of the per source level table
+typedef struct{
+  //level for each group of sources
+  unsigned char level[ERR_SRC_LEVEL_NUM];
+  //bit set for groups that do not follow the error level
+  unsigned char set[(ERR_SRC_LEVEL_NUM+7)/8];
+}ERR_SRC_LEVELS;
+
+//set error level for a range of sources, returns the old level for min or -ERR_INVALID_RANGE
+int set_error_source_level(unsigned short min,unsigned short max,unsigned char lev);
+
+//make a range of sources use the error level set by set_error_level
+void clear_error_source_level(unsigned short min,unsigned short max);
+
+//get the error level that applies to source
+unsigned char get_error_source_level(unsigned short source);
+
+//save and restore the per source level table
+void save_error_source_levels(ERR_SRC_LEVELS *dest);
+void restore_error_source_levels(const ERR_SRC_LEVELS *src);
+
+//get the number of errors dropped because the report queue was full
+unsigned long error_queue_overflows(void);
+
+//queue of errors waiting to be handled by a task, used by the library
+typedef struct{
+  //queue storage, size must be a power of two
+  ERROR_DAT *buf;
+  unsigned short size;
+  //queue indexes, head is written by reporters and tail by the task
+  volatile unsigned short head,tail;
+  //number of errors dropped because the queue was full
+  unsigned long dropped;
+  //event set and event to signal when errors are added
+  CTL_EVENT_SET_t *evt;
+  CTL_EVENT_SET_t ev;
+}ERR_QUEUE;
+
+struct ERR_SINK;
+
+//sink function, called from the sink task with each error and with NULL when the queue is empty or the sink timeout expires
+typedef void (*ERR_SINK_FUNC)(struct ERR_SINK *sink,const ERROR_DAT *err);
+
+//output sink, reported errors are queued for each sink and handed to the sink function by a task for the sink
+//so a slow sink does not hold up reporters or other sinks, errors are dropped when the sink queue is full
+typedef struct ERR_SINK{
+  //lowest level given to the sink, errors must also pass the error level for their source
+  unsigned char level;
+  //sink function and an argument for it
+  ERR_SINK_FUNC func;
+  void *arg;
+  //time in ms that the sink task waits for errors before calling the sink function with NULL, zero waits for errors
+  CTL_TIME_t timeout;
+  //dropped errors that have been read with error_sink_dropped
+  unsigned long reported;
+  //errors waiting for the sink
+  ERR_QUEUE queue;
+  CTL_EVENT_SET_t evt;
+  //sink task
+  CTL_TASK_t task;
+  //next sink in the list
+  struct ERR_SINK *next;
+}ERR_SINK;
+
+//add an output sink, errors at or above level are queued in buf which holds size errors, size must be a power of two
+//func is called from a task named name with priority pri that uses stack which is stack_size words long
+//returns RET_SUCCESS or ERR_INVALID_RANGE if size is not a power of two
+int error_sink_add(ERR_SINK *sink,const char *name,unsigned char level,ERR_SINK_FUNC func,void *arg,ERROR_DAT *buf,unsigned short size,unsigned char pri,unsigned *stack,unsigned stack_size);
+
+//set the lowest level given to a sink, returns the old level
+unsigned char error_sink_level(ERR_SINK *sink,unsigned char level);
+
+//set the time in ms that a sink waits for errors before the sink function is called with NULL, returns the old time
+CTL_TIME_t error_sink_timeout(ERR_SINK *sink,CTL_TIME_t timeout);
+
+//get the number of errors dropped by a sink since the last call
+unsigned long error_sink_dropped(ERR_SINK *sink);
+
+//sink function that prints errors to the console
+void error_sink_print(ERR_SINK *sink,const ERROR_DAT *err);
+
+//report an error, can be called from tasks or interrupts
 void report_error(unsigned char level,unsigned short source,int err, unsigned short argument);
 
+//report an error and wait until the logger task has recorded it, errors in flush mode ERR_FLUSH_NOW are on the SD card
+//when this returns, from an interrupt this is the same as report_error
+//an error that repeats one being counted is recorded with the count when the repeat window ends
+void report_error_sync(unsigned char level,unsigned short source,int err, unsigned short argument);
+
+//report an error without checking the error level, can be called from tasks or interrupts
+void _report_error(unsigned char level,unsigned short source,int err, unsigned short argument);
+
+//errors reported with the REPORT_ macros below this level are removed at compile time
+//this must be a number so it can be checked by the preprocessor, the levels are
+//ERR_LEV_DEBUG=0, ERR_LEV_INFO=30, ERR_LEV_WARNING=60, ERR_LEV_ERROR=90
+#ifndef ERR_MIN_LEVEL
+  #define ERR_MIN_LEVEL   (0)
+#endif
+
+//lowest level that report_error records or keeps in the flight recorder, set by the library when levels change
+extern unsigned char err_report_floor;
+
+//call report_error only if the level can pass any of the level checks
+//report_error still checks the level for the source, errors stopped here are not counted as filtered
+#define ERR_REPORT_CHECK(lev,src,err,arg)   do{if((lev)>=err_report_floor){report_error((lev),(src),(err),(arg));}}while(0)
+
+//report an error with a level that is known at compile time
+#define REPORT(lev,src,err,arg)   do{if((lev)>=ERR_MIN_LEVEL){ERR_REPORT_CHECK((lev),(src),(err),(arg));}}while(0)
+
+#if ERR_MIN_LEVEL<=0
+  #define REPORT_DEBUG(src,err,arg)     ERR_REPORT_CHECK(ERR_LEV_DEBUG,(src),(err),(arg))
+#else
+  #define REPORT_DEBUG(src,err,arg)     ((void)0)
+#endif
+
+#if ERR_MIN_LEVEL<=30
+  #define REPORT_INFO(src,err,arg)      ERR_REPORT_CHECK(ERR_LEV_INFO,(src),(err),(arg))
+#else
+  #define REPORT_INFO(src,err,arg)      ((void)0)
+#endif
+
+#if ERR_MIN_LEVEL<=60
+  #define REPORT_WARNING(src,err,arg)   ERR_REPORT_CHECK(ERR_LEV_WARNING,(src),(err),(arg))
+#else
+  #define REPORT_WARNING(src,err,arg)   ((void)0)
+#endif
+
+#if ERR_MIN_LEVEL<=90
+  #define REPORT_ERROR(src,err,arg)     ERR_REPORT_CHECK(ERR_LEV_ERROR,(src),(err),(arg))
+#else
+  #define REPORT_ERROR(src,err,arg)     ((void)0)
+#endif
+
+//critical errors are always compiled in and call report_error without checking err_report_floor
+//the report queue is private to the library and source levels still apply, so there is no inline path into the queue
+#define REPORT_CRITICAL(src,err,arg)    report_error(ERR_LEV_CRITICAL,(src),(err),(arg))
+
+//write errors that are only stored in RAM to the SD card (if used)
+int error_flush(void);
+
+//set the time in ms that ERR_FLUSH_DELAY errors can stay in RAM before they are written to the SD card, zero writes them right away
+CTL_TIME_t set_error_flush_timeout(CTL_TIME_t timeout);
+
+//ways that errors are written to the SD card
+//ERR_FLUSH_NOW writes the error before the next error is recorded, ERR_FLUSH_DELAY writes it before the flush timeout
+//expires and ERR_FLUSH_FULL leaves it in RAM until the block is full or a more important error is written
+//report_error does not wait for the write because it can be called from interrupts, use report_error_sync to wait
+enum{ERR_FLUSH_NOW=0,ERR_FLUSH_DELAY,ERR_FLUSH_FULL};
+
+//set how errors in a statistics level class (ERR_STAT_DEBUG to ERR_STAT_CRITICAL) are written to the SD card
+//returns the old mode or -1 if the class or mode is not valid
+int set_error_flush_mode(int cls,int mode);
+
+//due time used when the flusher task is not going to write the current block
+#define ERR_FLUSH_NOT_DUE     ((CTL_TIME_t)-1)
+
+//how far the SD card is behind the errors that have been reported
+typedef struct{
+  //errors that have been reported but not recorded yet
+  unsigned short queued;
+  //recorded errors that are only stored in RAM
+  unsigned short unwritten;
+  //time in ms since the oldest error that is only stored in RAM was recorded
+  CTL_TIME_t age;
+  //time in ms until the flusher task writes the current block or ERR_FLUSH_NOT_DUE
+  CTL_TIME_t due;
+}ERR_FLUSH_LAG;
+
+//get how far the SD card is behind the errors that have been reported
+void error_flush_lag(ERR_FLUSH_LAG *lag);
+
+//get number of SD card block writes and the number of writes saved by buffering errors
+void error_flush_stats(unsigned long *writes,unsigned long *saved);
+
+//set the time in ticker ticks that an error has to repeat within to be counted instead of recorded, zero disables repeat counting
+ticker set_error_repeat_window(ticker window);
+
+//filter used to select errors for replays
+typedef struct{
+  //lowest error level to include
+  unsigned char level;
+  //range of error sources to include
+  unsigned short src_min,src_max;
+  //range of ticker times to include
+  ticker t_min,t_max;
+}ERR_FILTER;
+
+//setup a filter that passes all errors with a level of at least level
+void error_filter_init(ERR_FILTER *filter,unsigned char level);
+
 //Print all errors in log
 void error_log_replay(unsigned short num,unsigned char level);
 
+//Print errors in log that pass filter
+//blocks are skipped using the summaries of recent blocks that are kept in RAM, older blocks are read and checked
+void error_log_replay_filter(unsigned short num,const ERR_FILTER *filter);
+
 //clear all errors from the SD card (if used)
+//blocks on the SD card are not erased, the log epoch is changed so that older blocks are ignored
 int clear_saved_errors(void);
 
 //read errors into a buffer
-void error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char level,unsigned char *buf);
+//returns RET_SUCCESS or an error from the SD card, errors in RAM are still read if the SD card could not be locked
+int error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char level,unsigned char *buf);
+
+//read errors that pass filter into a buffer, blocks are skipped like error_log_replay_filter
+int error_log_mem_replay_filter(unsigned char *dest,unsigned short size,const ERR_FILTER *filter,unsigned char *buf);
+
+//return values for error_cursor_next_batch
+enum{ERR_CURSOR_MORE=0,ERR_CURSOR_END,ERR_CURSOR_WRAPPED,ERR_CURSOR_SD_ERROR,ERR_CURSOR_CLOSED,ERR_CURSOR_TOO_SMALL};
+
+//cursor used to read the error log a batch at a time, fields are private to the error library
+typedef struct{
+  //SD card address of the block being read, or the slot count for errors in RAM
+  unsigned long addr;
+  //number of the block being read and the oldest block that can be read
+  unsigned short number,last;
+  //position of the next error in the block
+  unsigned short pos;
+  //filter used to select errors
+  ERR_FILTER filter;
+  //result of the last call
+  unsigned char state;
+}ERR_CURSOR;
+
+//open a cursor at the most recent error, if filter is NULL all errors are read
+void error_cursor_open(ERR_CURSOR *cur,const ERR_FILTER *filter);
+
+//read the next batch of errors into dest using the same format as error_log_mem_replay
+//dest must have room for at least two errors so that repeated errors fit
+//returns ERR_CURSOR_MORE if there are more errors to read or the reason that reading has stopped
+int error_cursor_next_batch(ERR_CURSOR *cur,unsigned char *dest,unsigned short size,unsigned char *buf);
+
+//close a cursor
+void error_cursor_close(ERR_CURSOR *cur);
+
+//result of checking an error block from an SD card image
+//ERR_BLK_SUPER is returned for the superblock, only the epoch is filled in
+enum{ERR_BLK_OK=0,ERR_BLK_EMPTY,ERR_BLK_BAD_CRC,ERR_BLK_SUPER,ERR_BLK_UNSUPPORTED};
+
+//header values of an error block from an SD card image
+typedef struct{
+  //block number, blocks are numbered in the order they were written
+  unsigned short number;
+  //log epoch that the block was written in
+  unsigned short epoch;
+  //number of errors in the block
+  unsigned short count;
+}ERR_BLK_INFO;
+
+//called for each error decoded from a block, repeat is the number of repeats and first is the time of the first repeat
+typedef void (*ERR_BLK_FUNC)(void *arg,const ERROR_DAT *dat,unsigned short repeat,ticker first);
+
+//check a 512 byte error block from an SD card image and get the header values, info is filled in unless ERR_BLK_EMPTY is returned
+//these do not use the state of the library so they can be used by tools to read card images, ERR_BLK_UNSUPPORTED without SD card support
+int error_block_info(const unsigned char *blk,ERR_BLK_INFO *info);
+
+//call func for each error in a block that passes filter from oldest to newest, if filter is NULL all errors are passed
+//returns the number of errors passed to func or -1 if the block is not valid
+int error_block_decode(const unsigned char *blk,const ERR_FILTER *filter,ERR_BLK_FUNC func,void *arg);
+
+//error values returned by error_export_next
+enum{ERR_EXPORT_SD_ERROR=-1,ERR_EXPORT_TOO_SMALL=-2};
+
+//export of the error log as a stream of SPI_ERROR_DAT packets, fields are private to the error library
+typedef struct{
+  //cursor used to read errors
+  ERR_CURSOR cur;
+  //sequence number of the next packet
+  unsigned short seq;
+  //address of the sender put in each packet
+  unsigned char src;
+}ERR_EXPORT;
+
+//start an export of the errors that pass filter, if filter is NULL all errors are exported
+//src is the bus address of the sender that is put in each packet
+void error_export_open(ERR_EXPORT *exp,const ERR_FILTER *filter,unsigned char src);
+
+//build the next SPI_ERROR_DAT packet of an export in pkt, buf is used to read SD card blocks and must not overlap pkt
+//returns the length of the packet, zero after the last packet or an ERR_EXPORT_ error
+//on ERR_EXPORT_SD_ERROR nothing was read and the call can be repeated
+int error_export_next(ERR_EXPORT *exp,unsigned char *pkt,unsigned short size,unsigned char *buf);
+
+//send the errors that pass filter to addr as a stream of SPI_ERROR_DAT packets built in the bus buffer
+//src is the bus address of the sender, returns RET_SUCCESS or an error from the bus
+int error_export_spi(unsigned char addr,unsigned char src,const ERR_FILTER *filter);
+
+//size of the SPI_ERROR_DAT packets sent by an error forwarder including the header, sizes ERR_FWD.pkt
+#define ERR_FWD_PKT_SIZE    (128)
+
+//error forwarder, an output sink that sends errors to another board as a never ending stream of SPI_ERROR_DAT packets
+//a packet is sent when it is full or when its first error has waited for the forwarder delay
+//when the bus is busy the forwarder backs off, if a full packet still can not be sent its sequence number is skipped
+//so the receiver reports missing packets
+typedef struct{
+  //sink that errors are given to
+  ERR_SINK sink;
+  //bus address that packets are sent to and sender address in the packets
+  unsigned char addr,src;
+  //time in ms that errors can wait for a full packet
+  CTL_TIME_t delay;
+  //time that the first error was added to the packet and time that the bus can be tried again
+  CTL_TIME_t first,retry;
+  //time in ms to wait after the bus was busy, doubled each time the bus is busy
+  CTL_TIME_t backoff;
+  //sequence number of the next packet
+  unsigned short seq;
+  //bytes used in the packet and number of errors in it
+  unsigned short len,num;
+  //base time of errors in the packet
+  ticker base;
+  //packets sent, times that the bus was busy and errors lost in packets that could not be sent or dropped by the sink queue
+  unsigned long sent,busy,lost;
+  //packet being built
+  unsigned char pkt[ERR_FWD_PKT_SIZE];
+}ERR_FWD;
+
+//forward errors at or above level to the board at addr, src is the address of this board
+//buf, size, pri, stack and stack_size are used for the forwarder sink as in error_sink_add
+//returns RET_SUCCESS or ERR_INVALID_RANGE if size is not a power of two
+int error_forward_start(ERR_FWD *fwd,unsigned char addr,unsigned char src,unsigned char level,CTL_TIME_t delay,ERROR_DAT *buf,unsigned short size,unsigned char pri,unsigned *stack,unsigned stack_size);
+
+//flight recorder level that turns off the flight recorder
+enum{ERR_FR_OFF=0xFF};
+
+//set the lowest level kept by the flight recorder and the level that saves a snapshot of it
+//until this is called the flight recorder keeps the same levels as the log level set by set_error_level
+void set_error_flight_recorder(unsigned char level,unsigned char trigger);
+
+//print a list of flight recorder snapshots saved on the SD card, most recent first
+void error_snapshot_list(void);
+
+//print the errors in a snapshot, zero is the most recent snapshot
+void error_snapshot_dump(unsigned short idx);
+
+//read the errors in a snapshot into a buffer in the same format as error_log_mem_replay
+//returns the number of errors read or -1 if the snapshot could not be read
+//if buf is the bus buffer the SD card must be locked with mmcLock before the buffer is taken
+int error_snapshot_mem(unsigned short idx,unsigned char *dest,unsigned short size,unsigned char *buf);
+
+//number of sources tracked by the error statistics, sizes ERR_STATS.top
+#define ERR_STAT_TOP    (8)
+
+//error statistics level classes, these match the strings from ERR_lev_str
+enum{ERR_STAT_DEBUG=0,ERR_STAT_INFO,ERR_STAT_WARNING,ERR_STAT_ERROR,ERR_STAT_CRITICAL,ERR_STAT_LEVELS};
+
+//count for a frequently seen source, the real count is between count-over and count
+typedef struct{
+  unsigned short source;
+  unsigned short count;
+  unsigned short over;
+}ERR_STAT_SRC;
+
+//error statistics
+typedef struct{
+  //errors recorded in each level class
+  unsigned long levels[ERR_STAT_LEVELS];
+  //errors dropped because a queue was full
+  unsigned long dropped;
+  //errors that were not recorded because of their level
+  unsigned long filtered;
+  //log blocks skipped by replays because the block header or CRC was not valid
+  unsigned long bad_blocks;
+  //time of the first and last recorded error
+  ticker first,last;
+  //sources seen most often, unused entries have a count of zero
+  ERR_STAT_SRC top[ERR_STAT_TOP];
+}ERR_STATS;
+
+//get error statistics
+void error_stats(ERR_STATS *dest);
+
+//clear error statistics
+void error_stats_clear(void);
+
+//print error statistics
+void print_error_stats(void);
+
+//phases of error handling timed when ERR_LATENCY_STATS is defined
+enum{ERR_LAT_REPORT=0,ERR_LAT_MUTEX,ERR_LAT_WRITE,ERR_LAT_PRINT,ERR_LAT_PHASES};
+
+//number of latency histogram bins, bin n counts times with n significant bits
+#define ERR_LAT_BINS      (16)
+
+//latency of one phase in timer counts
+typedef struct{
+  unsigned long count;
+  unsigned long total;
+  unsigned short min,max;
+  unsigned short hist[ERR_LAT_BINS];
+}ERR_LAT;
+
+//latency statistics
+typedef struct{
+  ERR_LAT phase[ERR_LAT_PHASES];
+  //number of times the saved errors mutex or the SD card could not be locked
+  unsigned long timeouts;
+  //number of failed SD card operations
+  unsigned long sd_fail;
+}ERR_LAT_STATS;
+
+//get latency statistics, returns zero if latency statistics are not enabled
+int error_latency_stats(ERR_LAT_STATS *dest);
+
+//clear latency statistics
+void error_latency_clear(void);
+
+//print latency statistics
+void print_error_latency(void);
 
 //print errors received over SPI
 void print_spi_err(const unsigned char *dat,unsigned short len);
 
 //register error handler with error library
-int err_register_handler(char min, char max,ERR_DECODE decode,unsigned short flags);
+int err_register_handler(unsigned short min,unsigned short max,ERR_DECODE decode,unsigned short flags);
 
 #endif
   
\ No newline at end of file
@@ -6,84 +6,291 @@
 #include <commandLib.h>
 
 #ifdef SD_CARD_OUTPUT
-  #include <crc.h>
   #include <SDlib.h>
 #endif
 
-#define NUM_HANDLERS        (4)
+//put a variable in RAM that is not cleared by the startup code so that recent errors are kept through a warm reset
+//define ERR_NOINIT for a toolchain that uses a different section or define it as nothing to clear errors on every reset
+//the CrossWorks build defines it in Error.hzp, the section placement of the application must not clear .noinit
+#ifndef ERR_NOINIT
+  #ifdef __GNUC__
+    #define ERR_NOINIT    __attribute__((section(".noinit")))
+  #else
+    #define ERR_NOINIT
+  #endif
+#endif
+
+//number of error decode handlers that can be registered
+#ifndef ERR_NUM_HANDLERS
+  #define ERR_NUM_HANDLERS    (16)
+#endif
 
 typedef struct{
-  char min,max;
+  unsigned short min,max;
   ERR_DECODE decode;
   unsigned short flags;
 }ERR_DCODER;
 
 static int err_next_decode=0;
 
-static ERR_DCODER decode_tbl[NUM_HANDLERS];
+//decode handlers sorted by source range
+static ERR_DCODER decode_tbl[ERR_NUM_HANDLERS];
 
-int err_register_handler(char min, char max,ERR_DECODE decode,unsigned short flags){
-  int i;
+//find the index of the first handler with a minimum source greater than source
+static int err_decode_search(unsigned short source){
+  int lo=0,hi=err_next_decode,mid;
+  while(lo<hi){
+    mid=(lo+hi)/2;
+    if(decode_tbl[mid].min<=source){
+      lo=mid+1;
+    }else{
+      hi=mid;
+    }
+  }
+  return lo;
+}
+
+int err_register_handler(unsigned short min,unsigned short max,ERR_DECODE decode,unsigned short flags){
+  int i,idx;
   //check for available decode slot
-  if(err_next_decode>=NUM_HANDLERS){
+  if(err_next_decode>=ERR_NUM_HANDLERS){
     return ERR_TABLE_FULL;
   }
   //check that min is greater than max
   if(min>max){
     return ERR_INVALID_RANGE;
   }
-  //check for overlapping ranges
-  for(i=0;i<err_next_decode;i++){
-    //check for overlapping errors
-    if((decode_tbl[i].min<=max && decode_tbl[i].min>=min) ||
-       (decode_tbl[i].max<=max && decode_tbl[i].max>=min) ){
-      return ERR_OVERLAP;
-    }
+  //find where the handler goes in the table
+  idx=err_decode_search(min);
+  //ranges don't overlap so only the handlers on either side need to be checked
+  if((idx>0 && decode_tbl[idx-1].max>=min) || (idx<err_next_decode && decode_tbl[idx].min<=max)){
+    return ERR_OVERLAP;
+  }
+  //make room for the new handler
+  for(i=err_next_decode;i>idx;i--){
+    decode_tbl[i]=decode_tbl[i-1];
   }
   //add handler to list
-  decode_tbl[err_next_decode].decode=decode;
-  decode_tbl[err_next_decode].min=min;
-  decode_tbl[err_next_decode].max=max;
-  decode_tbl[err_next_decode].flags=flags;
-  //increment index
+  decode_tbl[idx].decode=decode;
+  decode_tbl[idx].min=min;
+  decode_tbl[idx].max=max;
+  decode_tbl[idx].flags=flags;
+  //increment count
   err_next_decode++;
   //success
   return RET_SUCCESS;
 }
 
 #define SAVED_ERROR_MAGIC   0xA5
+//magic number for a repeated error, the slot before it in time holds the repeat information
+#define REPEAT_ERROR_MAGIC  0xA6
+//magic number for repeat information, argument is the repeat count and time is the time of the first repeat
+#define REPEAT_INFO_MAGIC   0xA7
+
+//decoded error with repeat information
+typedef struct{
+  //error data, time is the time of the last repeat for repeated errors
+  ERROR_DAT dat;
+  //number of times the error repeated, zero for a single error
+  unsigned short repeat;
+  //time of the first repeat
+  ticker first;
+}ERR_REC;
 //signature values for SD card storage
 //TODO: decide on good values to use (below values are quite arbitrary)
 #define ERROR_BLOCK_SIGNATURE1    0xA55A
-#define ERROR_BLOCK_SIGNATURE2    0xCB31
+//second signature was changed from 0xCB31 when errors were stored in fixed size records
+#define ERROR_BLOCK_SIGNATURE2    0xCB32
+
+//Errors are encoded as a sequence of variable length integers: level, source, error, argument and time.
+//Each integer is stored 7 bits at a time with the high bit set in all but the last byte. Because the last byte of each
+//integer is the only one with the high bit clear, records can be walked backwards as well as forwards.
+//Error codes are zigzag encoded so that small negative numbers are short. Times are stored relative to a base time
+//and are also zigzag encoded in case errors are recorded slightly out of order.
+//Repeated errors start with ERR_REC_REPEAT plus the repeat count and the time of the first repeat followed by the
+//usual fields with ERR_REC_REPEAT added to the level so the record can be recognized from either end.
+
+//number of integers in an encoded error
+#define ERR_REC_FIELDS      (5)
+//number of extra integers in an encoded repeated error
+#define ERR_REC_REPEAT_FIELDS (2)
+//added to the level and repeat count of repeated errors
+#define ERR_REC_REPEAT      (0x100)
+//maximum size of an encoded error
+#define ERR_REC_MAX         (3+5+2+3+5+3+5)
 
 void print_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time);
+static void print_rec(const ERR_REC *rec,unsigned short flags);
+static void error_log_func(void *p);
+#ifdef SD_CARD_OUTPUT
+  static void err_index_build(void);
+#endif
 
 //returned by _record_error to tell if a block has been filled
 enum {BLOCK_NOT_FULL=0,BLOCK_FULL};
 
 
 #ifdef SD_CARD_OUTPUT
-  //number of errors in a block
-  #define NUM_ERRORS      (504/sizeof(ERROR_DAT))
+  //block format version
+  #define ERROR_BLOCK_VERSION   5
+  //size of the block header
+  #define ERR_BLOCK_HEADER_SIZE (30)
+  //number of bytes for encoded errors in a block, leaves room for the header and CRC
+  #define ERR_BLOCK_DATA_SIZE   (512-ERR_BLOCK_HEADER_SIZE-2)
+  //summary of the errors in a block so that replays can skip blocks that can not match
+  typedef struct{
+    //earliest and latest error times in the block
+    ticker tmin,tmax;
+    //one bit for each hashed error source in the block, zero for an empty block
+    unsigned short sources;
+    //highest error level in the block
+    unsigned char max_level;
+    //unused, keeps the header an even size
+    unsigned char resv;
+  }ERR_SUMMARY;
   //A block of errors
   typedef struct{
     //magic numbers to identify data from randomness
     unsigned short sig1,sig2;
     //error block number used to figure out which block is the most recent
     unsigned short number;
-    //actual saved error data
-    ERROR_DAT saved_errors[NUM_ERRORS];
-    //CRC to make sure that data is not corrupted
+    //number of bytes of data used by encoded errors
+    unsigned short used;
+    //time of the first error in the block, error times are stored relative to this
+    ticker base;
+    //block format version
+    unsigned char version;
+    //number of errors in the block
+    unsigned char count;
+    //CRC of the used part of data, updated as errors are added
+    unsigned short dcrc;
+    //summary of the errors in the block
+    ERR_SUMMARY sum;
+    //log epoch, blocks from other epochs were cleared
+    unsigned short epoch;
+    //encoded errors
+    unsigned char data[ERR_BLOCK_DATA_SIZE];
+    //CRC of the header to make sure that data is not corrupted
     unsigned short chk;
   }ERROR_BLOCK;
-  //place to store the error data
-  static ERROR_BLOCK errors;
+  //number of RAM blocks, each one uses 512 bytes of RAM
+  //errors are added to one block while full blocks are written to the SD card by the flusher task
+  #ifndef ERR_NUM_BLOCKS
+    #define ERR_NUM_BLOCKS        (2)
+  #endif
+  //place to store the error data, kept through a warm reset
+  static ERROR_BLOCK errors[ERR_NUM_BLOCKS] ERR_NOINIT;
+  //index of the block that errors are added to
+  static short err_cur ERR_NOINIT;
+  //number of full blocks waiting to be written, these are the blocks before err_cur
+  static short err_pending ERR_NOINIT;
+  //SD card address for each RAM block
+  static SD_block_addr err_blk_addr[ERR_NUM_BLOCKS] ERR_NOINIT;
+  //held while full blocks are written
+  static CTL_MUTEX_t err_write_mutex;
   //SD card address to store data to
   //static SD_blolck_addr current_block;
-  static long current_block;
+  static long current_block ERR_NOINIT;
+  //start of the error region, the superblock and the flight recorder snapshots are at the start of the region
+  static SD_block_addr err_region_start=ERR_ADDR_START;
+  //SD card address range for error log blocks, the log takes the rest of the region
+  static SD_block_addr err_addr_start=ERR_LOG_BLOCK(ERR_ADDR_START),err_addr_end=ERR_ADDR_END;
+  //current log epoch, incremented when the log is cleared
+  static unsigned short err_epoch;
+  //number of blocks in the error log
+  #define ERR_REGION_SIZE       (err_addr_end-err_addr_start+1)
+  #ifdef ERR_SD_MULTI_BLOCK
+    //blocks read at once when replaying, uses 512 bytes of RAM per block
+    #ifndef ERR_READ_AHEAD
+      #define ERR_READ_AHEAD      (4)
+    #endif
+    //blocks that have been read ahead
+    static unsigned char err_ra_buf[ERR_READ_AHEAD*512];
+    static SD_block_addr err_ra_addr;
+    static unsigned short err_ra_count;
+    //incremented for each write so that blocks that were read ahead are not used after a write
+    static unsigned short err_sd_gen,err_ra_gen;
+  #endif
   //used to derermine if library is ready to store data to the SD card
-  static running;
+  static int running;
+  //times to try to get the bus buffer when recording starts
+  #ifndef ERR_START_BUF_TRIES
+    #define ERR_START_BUF_TRIES   (5)
+  #endif
+  //time in ms that the block can remain dirty before it is written to the SD card
+  #ifndef ERR_FLUSH_TIMEOUT
+    #define ERR_FLUSH_TIMEOUT     (1024)
+  #endif
+  //priority for the flusher task
+  #ifndef ERR_FLUSH_PRI
+    #define ERR_FLUSH_PRI         (20)
+  #endif
+  //stack size for the flusher task
+  #ifndef ERR_FLUSH_STACK
+    #define ERR_FLUSH_STACK       (128)
+  #endif
+  //events for the flusher task
+  enum{ERR_FLUSH_EV_DIRTY=1<<0,ERR_FLUSH_EV_FULL=1<<1};
+  static CTL_EVENT_SET_t err_flush_evt;
+  //flusher task structure and stack
+  static CTL_TASK_t err_flush_task;
+  static unsigned err_flush_stack[ERR_FLUSH_STACK];
+  //current dirty timeout, zero means write every error
+  static CTL_TIME_t err_flush_timeout;
+  //set when the RAM block has errors that are not on the SD card
+  static short err_dirty;
+  //time that the flusher task has to write the current block by, only used when err_flush_armed is set
+  static CTL_TIME_t err_flush_due;
+  static short err_flush_armed;
+  //default way that errors in each level class are written to the SD card
+  #ifndef ERR_FLUSH_MODE_DEBUG
+    #define ERR_FLUSH_MODE_DEBUG      (ERR_FLUSH_FULL)
+  #endif
+  #ifndef ERR_FLUSH_MODE_INFO
+    #define ERR_FLUSH_MODE_INFO       (ERR_FLUSH_FULL)
+  #endif
+  #ifndef ERR_FLUSH_MODE_WARNING
+    #define ERR_FLUSH_MODE_WARNING    (ERR_FLUSH_DELAY)
+  #endif
+  #ifndef ERR_FLUSH_MODE_ERROR
+    #define ERR_FLUSH_MODE_ERROR      (ERR_FLUSH_DELAY)
+  #endif
+  #ifndef ERR_FLUSH_MODE_CRITICAL
+    #define ERR_FLUSH_MODE_CRITICAL   (ERR_FLUSH_NOW)
+  #endif
+  //current way that errors in each level class are written
+  static unsigned char err_flush_mode[ERR_STAT_LEVELS];
+  //number of errors in each RAM block that are not on the SD card and the time that the first of them was recorded
+  static unsigned short err_unwritten[ERR_NUM_BLOCKS];
+  static CTL_TIME_t err_unwritten_time[ERR_NUM_BLOCKS];
+  //number of errors appended and number of blocks written
+  static unsigned long err_appended,err_blk_writes;
+  //number of block summaries kept in RAM, the index only covers the newest ERR_INDEX_SIZE blocks of the log
+  //it is filled by the flusher task once recording has started so a filtered replay reads any older block
+  #ifndef ERR_INDEX_SIZE
+    #define ERR_INDEX_SIZE        (64)
+  #endif
+  //source ranges larger than this are not checked against the source bits
+  #ifndef ERR_SRC_SCAN_MAX
+    #define ERR_SRC_SCAN_MAX      (32)
+  #endif
+  //RAM copy of a block summary
+  typedef struct{
+    //summary from the block header
+    ERR_SUMMARY sum;
+    //block number, the entry is for the block number that is stored here
+    unsigned short number;
+    //block address relative to the start of the error region
+    unsigned short offset;
+    //set when the entry has been filled in
+    unsigned char valid;
+  }ERR_INDEX_ENT;
+  //summaries of recent blocks indexed by block number
+  static ERR_INDEX_ENT err_index[ERR_INDEX_SIZE];
+  //held while the index is changed, taken last so summaries can be added while the SD card is locked
+  static CTL_MUTEX_t err_index_mutex;
+  //number of the block that errors are added to, its summary in RAM is newer than the one on the SD card
+  static unsigned short err_index_live;
 #else
   //number of errors in a block
   #define NUM_ERRORS      (64)
@@ -92,294 +299,2630 @@ enum {BLOCK_NOT_FULL=0,BLOCK_FULL};
     //actual saved error data
     ERROR_DAT saved_errors[NUM_ERRORS];
   }ERROR_BLOCK;
-  //place to store the error data
-  static ERROR_BLOCK errors;
+  //place to store the error data, kept through a warm reset
+  static ERROR_BLOCK errors ERR_NOINIT;
+  //total number of slots written, used by cursors to find their place in the ring
+  static unsigned long err_ram_total ERR_NOINIT;
 #endif
 
 //pointer to the current block of errors
 static ERROR_BLOCK *err_dest;
 //next index to store errors to
-int next_idx;
+int next_idx ERR_NOINIT;
+
+//magic number for errors that are kept through a reset
+#define ERR_KEEP_MAGIC      (0x4B45)
+//header that tells if the errors in RAM were kept through a reset
+typedef struct{
+  //ERR_KEEP_MAGIC when the errors in RAM can be used
+  unsigned short magic;
+  //number of warm resets that the errors have been kept through
+  unsigned short resets;
+  //CRC of the header and the position of the errors in RAM
+  unsigned short chk;
+}ERR_KEEP;
+static ERR_KEEP err_keep ERR_NOINIT;
 //mutex for error storage
+//SD card paths take locks in this order: err_write_mutex, saved_err_mutex, the SD card, the bus buffer, err_index_mutex
+//any lock can be skipped but a lock is never taken while holding a lock that comes after it
 static CTL_MUTEX_t saved_err_mutex;
 
 //log level
-static char log_level=0;
+static unsigned char log_level=0;
 
+//level that each group of sources must meet to be recorded, groups that have not been set follow log_level
+static unsigned char err_src_lev[ERR_SRC_LEVEL_NUM];
+//bit set for groups that have their own level
+static unsigned char err_src_set[(ERR_SRC_LEVEL_NUM+7)/8];
 
-//initialize error reporting system
-void error_init(void){
-  next_idx=0;
-  memset(&errors,0,sizeof(ERROR_BLOCK));
-  err_dest=&errors;
-  ctl_mutex_init(&saved_err_mutex);
-  #ifdef SD_CARD_OUTPUT
-    current_block=-1;
-    errors.sig1=ERROR_BLOCK_SIGNATURE1;
-    errors.sig2=ERROR_BLOCK_SIGNATURE2;
-    running=0;
-  #endif
+//initial value for CRC calculations
+#define ERR_CRC_INIT        (0xFFFF)
+
+//table for CRC-CCITT (polynomial 0x1021) calculated one byte at a time
+static const unsigned short err_crc_tbl[256]={
+  0x0000,0x1021,0x2042,0x3063,0x4084,0x50A5,0x60C6,0x70E7,
+  0x8108,0x9129,0xA14A,0xB16B,0xC18C,0xD1AD,0xE1CE,0xF1EF,
+  0x1231,0x0210,0x3273,0x2252,0x52B5,0x4294,0x72F7,0x62D6,
+  0x9339,0x8318,0xB37B,0xA35A,0xD3BD,0xC39C,0xF3FF,0xE3DE,
+  0x2462,0x3443,0x0420,0x1401,0x64E6,0x74C7,0x44A4,0x5485,
+  0xA56A,0xB54B,0x8528,0x9509,0xE5EE,0xF5CF,0xC5AC,0xD58D,
+  0x3653,0x2672,0x1611,0x0630,0x76D7,0x66F6,0x5695,0x46B4,
+  0xB75B,0xA77A,0x9719,0x8738,0xF7DF,0xE7FE,0xD79D,0xC7BC,
+  0x48C4,0x58E5,0x6886,0x78A7,0x0840,0x1861,0x2802,0x3823,
+  0xC9CC,0xD9ED,0xE98E,0xF9AF,0x8948,0x9969,0xA90A,0xB92B,
+  0x5AF5,0x4AD4,0x7AB7,0x6A96,0x1A71,0x0A50,0x3A33,0x2A12,
+  0xDBFD,0xCBDC,0xFBBF,0xEB9E,0x9B79,0x8B58,0xBB3B,0xAB1A,
+  0x6CA6,0x7C87,0x4CE4,0x5CC5,0x2C22,0x3C03,0x0C60,0x1C41,
+  0xEDAE,0xFD8F,0xCDEC,0xDDCD,0xAD2A,0xBD0B,0x8D68,0x9D49,
+  0x7E97,0x6EB6,0x5ED5,0x4EF4,0x3E13,0x2E32,0x1E51,0x0E70,
+  0xFF9F,0xEFBE,0xDFDD,0xCFFC,0xBF1B,0xAF3A,0x9F59,0x8F78,
+  0x9188,0x81A9,0xB1CA,0xA1EB,0xD10C,0xC12D,0xF14E,0xE16F,
+  0x1080,0x00A1,0x30C2,0x20E3,0x5004,0x4025,0x7046,0x6067,
+  0x83B9,0x9398,0xA3FB,0xB3DA,0xC33D,0xD31C,0xE37F,0xF35E,
+  0x02B1,0x1290,0x22F3,0x32D2,0x4235,0x5214,0x6277,0x7256,
+  0xB5EA,0xA5CB,0x95A8,0x8589,0xF56E,0xE54F,0xD52C,0xC50D,
+  0x34E2,0x24C3,0x14A0,0x0481,0x7466,0x6447,0x5424,0x4405,
+  0xA7DB,0xB7FA,0x8799,0x97B8,0xE75F,0xF77E,0xC71D,0xD73C,
+  0x26D3,0x36F2,0x0691,0x16B0,0x6657,0x7676,0x4615,0x5634,
+  0xD94C,0xC96D,0xF90E,0xE92F,0x99C8,0x89E9,0xB98A,0xA9AB,
+  0x5844,0x4865,0x7806,0x6827,0x18C0,0x08E1,0x3882,0x28A3,
+  0xCB7D,0xDB5C,0xEB3F,0xFB1E,0x8BF9,0x9BD8,0xABBB,0xBB9A,
+  0x4A75,0x5A54,0x6A37,0x7A16,0x0AF1,0x1AD0,0x2AB3,0x3A92,
+  0xFD2E,0xED0F,0xDD6C,0xCD4D,0xBDAA,0xAD8B,0x9DE8,0x8DC9,
+  0x7C26,0x6C07,0x5C64,0x4C45,0x3CA2,0x2C83,0x1CE0,0x0CC1,
+  0xEF1F,0xFF3E,0xCF5D,0xDF7C,0xAF9B,0xBFBA,0x8FD9,0x9FF8,
+  0x6E17,0x7E36,0x4E55,0x5E74,0x2E93,0x3EB2,0x0ED1,0x1EF0
+};
+
+//add data to a CRC
+static unsigned short err_crc16(unsigned short crc,const unsigned char *dat,unsigned short len){
+  while(len--){
+    crc=(crc<<8)^err_crc_tbl[((crc>>8)^*dat++)&0xFF];
+  }
+  return crc;
 }
-  
+
+//write a variable length integer, returns a pointer to the next byte
+static unsigned char *err_put_varint(unsigned char *dest,unsigned long val){
+  //write 7 bits at a time with the high bit set if more bytes follow
+  while(val>=0x80){
+    *dest++=(val&0x7F)|0x80;
+    val>>=7;
+  }
+  *dest++=val;
+  return dest;
+}
+
+//read a variable length integer, returns a pointer to the next byte
+static const unsigned char *err_get_varint(const unsigned char *src,unsigned long *val){
+  unsigned long v=0;
+  unsigned char c;
+  int shift;
+  for(shift=0;;shift+=7){
+    c=*src++;
+    v|=((unsigned long)(c&0x7F))<<shift;
+    //stop at the last byte, limit length in case of bad data
+    if(!(c&0x80) || shift>=28){
+      break;
+    }
+  }
+  *val=v;
+  return src;
+}
+
+//zigzag encode a signed value so that small negative values are small
+static unsigned long err_zigzag(long val){
+  return (((unsigned long)val)<<1)^(unsigned long)(val<0?-1L:0);
+}
+
+//decode a zigzag encoded value
+static long err_unzigzag(unsigned long val){
+  return (long)((val>>1)^(0-(val&1)));
+}
+
+//encode an error, returns the number of bytes used which is at most ERR_REC_MAX
+static unsigned short err_rec_encode(unsigned char *dest,const ERR_REC *rec,ticker base){
+  unsigned char *ptr=dest;
+  //check for repeated error
+  if(rec->repeat){
+    //repeat count and time of first repeat
+    ptr=err_put_varint(ptr,ERR_REC_REPEAT+rec->repeat);
+    ptr=err_put_varint(ptr,err_zigzag((long)(rec->first-base)));
+    //level marked as repeated
+    ptr=err_put_varint(ptr,ERR_REC_REPEAT|rec->dat.level);
+  }else{
+    ptr=err_put_varint(ptr,rec->dat.level);
+  }
+  ptr=err_put_varint(ptr,rec->dat.source);
+  ptr=err_put_varint(ptr,err_zigzag(rec->dat.err));
+  ptr=err_put_varint(ptr,rec->dat.argument);
+  //time relative to the base time
+  ptr=err_put_varint(ptr,err_zigzag((long)(rec->dat.time-base)));
+  return ptr-dest;
+}
+
+//decode the error at pos, returns the position of the next error
+static unsigned short err_rec_decode(const unsigned char *data,unsigned short pos,ticker base,ERR_REC *dest){
+  const unsigned char *ptr=data+pos;
+  unsigned long val;
+  ptr=err_get_varint(ptr,&val);
+  //check for repeated error
+  if(val>=ERR_REC_REPEAT){
+    dest->repeat=val-ERR_REC_REPEAT;
+    ptr=err_get_varint(ptr,&val);
+    dest->first=base+(ticker)err_unzigzag(val);
+    //get level
+    ptr=err_get_varint(ptr,&val);
+    dest->dat.valid=REPEAT_ERROR_MAGIC;
+  }else{
+    dest->repeat=0;
+    dest->first=0;
+    dest->dat.valid=SAVED_ERROR_MAGIC;
+  }
+  dest->dat.level=val;
+  ptr=err_get_varint(ptr,&val);
+  dest->dat.source=val;
+  ptr=err_get_varint(ptr,&val);
+  dest->dat.err=(int)err_unzigzag(val);
+  ptr=err_get_varint(ptr,&val);
+  dest->dat.argument=val;
+  ptr=err_get_varint(ptr,&val);
+  dest->dat.time=base+(ticker)err_unzigzag(val);
+  return ptr-data;
+}
+
+//find the end of the error at pos without reading past len, returns zero if the error is truncated
+static unsigned short err_rec_end(const unsigned char *data,unsigned short pos,unsigned short len){
+  unsigned short start;
+  unsigned long val;
+  int i,fields=ERR_REC_FIELDS;
+  for(i=0;i<fields;i++){
+    start=pos;
+    //skip to the last byte of the integer
+    while(pos<len && (data[pos]&0x80)){
+      pos++;
+    }
+    //check for end of data
+    if(pos>=len){
+      return 0;
+    }
+    //skip last byte
+    pos++;
+    //check first integer for repeated error
+    if(i==0){
+      err_get_varint(data+start,&val);
+      if(val>=ERR_REC_REPEAT){
+        fields+=ERR_REC_REPEAT_FIELDS;
+      }
+    }
+  }
+  return pos;
+}
+
 #ifdef SD_CARD_OUTPUT
-  static int write_error_block(SD_block_addr addr,ERROR_BLOCK *data){
-    //compute CRC
-    data->chk=crc16((unsigned char*)err_dest,sizeof(ERROR_BLOCK)-sizeof(data->chk));
-    //write block
-    return mmcWriteBlock(current_block,(unsigned char*)data);
+  //find the start of the integer that ends at pos
+  static unsigned short err_int_prev(const unsigned char *data,unsigned short pos){
+    if(pos>0){
+      //skip last byte of the integer
+      pos--;
+      //skip the rest of the integer
+      while(pos>0 && (data[pos-1]&0x80)){
+        pos--;
+      }
+    }
+    return pos;
+  }
+
+  //find the start of the error that ends at pos
+  static unsigned short err_rec_prev(const unsigned char *data,unsigned short pos){
+    unsigned long val;
+    int i;
+    for(i=0;i<ERR_REC_FIELDS;i++){
+      pos=err_int_prev(data,pos);
+    }
+    //check level for repeated error
+    err_get_varint(data+pos,&val);
+    if(val>=ERR_REC_REPEAT){
+      //skip repeat information
+      for(i=0;i<ERR_REC_REPEAT_FIELDS;i++){
+        pos=err_int_prev(data,pos);
+      }
+    }
+    return pos;
+  }
+
+  //clear the errors in a block
+  static void err_block_reset(ERROR_BLOCK *blk){
+    blk->epoch=err_epoch;
+    blk->used=0;
+    blk->count=0;
+    blk->base=0;
+    blk->dcrc=ERR_CRC_INIT;
+    memset(&blk->sum,0,sizeof(blk->sum));
+    memset(blk->data,0,sizeof(blk->data));
+  }
+
+  //check that a block header is valid for any epoch
+  static int err_block_format_ok(const ERROR_BLOCK *blk){
+    return blk->sig1==ERROR_BLOCK_SIGNATURE1 && blk->sig2==ERROR_BLOCK_SIGNATURE2 && blk->version==ERROR_BLOCK_VERSION && blk->used<=ERR_BLOCK_DATA_SIZE;
+  }
+
+  //check that a block header is valid and the block has not been cleared
+  static int err_block_header_ok(const ERROR_BLOCK *blk){
+    return err_block_format_ok(blk) && blk->epoch==err_epoch;
+  }
+
+  //check the CRCs of a block, the header CRC covers the data CRC so only used data is checked
+  static int err_block_crc_ok(const ERROR_BLOCK *blk){
+    return blk->chk==err_crc16(ERR_CRC_INIT,(const unsigned char*)blk,ERR_BLOCK_HEADER_SIZE) && blk->dcrc==err_crc16(ERR_CRC_INIT,blk->data,blk->used);
+  }
+
+  //get the summary bit for an error source
+  static unsigned short err_src_bit(unsigned short source){
+    //use the top 4 bits of a multiplicative hash so nearby sources get different bits
+    return 1u<<((unsigned short)(source*0x9E37u)>>12);
+  }
+
+  //get the summary bits that a range of sources could set
+  static unsigned short err_src_mask(unsigned short min,unsigned short max){
+    unsigned short mask=0;
+    unsigned long s;
+    //large ranges will set most bits anyway
+    if(max-min>=ERR_SRC_SCAN_MAX){
+      return 0xFFFF;
+    }
+    for(s=min;s<=max;s++){
+      mask|=err_src_bit(s);
+    }
+    return mask;
+  }
+
+  //add an error to a block summary
+  static void err_sum_add(ERR_SUMMARY *sum,const ERR_REC *rec){
+    ticker start=rec->repeat?rec->first:rec->dat.time;
+    //check for first error in the block
+    if(!sum->sources){
+      sum->tmin=start;
+      sum->tmax=rec->dat.time;
+      sum->max_level=rec->dat.level;
+    }
+    if(start<sum->tmin){
+      sum->tmin=start;
+    }
+    if(rec->dat.time>sum->tmax){
+      sum->tmax=rec->dat.time;
+    }
+    if(rec->dat.level>sum->max_level){
+      sum->max_level=rec->dat.level;
+    }
+    sum->sources|=err_src_bit(rec->dat.source);
+  }
+
+  //check if a block with the given summary could have errors that pass the filter
+  //src_mask is the value of err_src_mask for the filter
+  static int err_sum_match(const ERR_SUMMARY *sum,const ERR_FILTER *filter,unsigned short src_mask){
+    return (sum->sources&src_mask) && sum->max_level>=filter->level && sum->tmax>=filter->t_min && sum->tmin<=filter->t_max;
+  }
+
+  //store the summary for a block in the index, the index mutex must be locked
+  static void err_index_put(const ERROR_BLOCK *blk,SD_block_addr addr){
+    ERR_INDEX_ENT *ent=&err_index[blk->number%ERR_INDEX_SIZE];
+    ent->sum=blk->sum;
+    ent->number=blk->number;
+    ent->offset=addr-err_addr_start;
+    ent->valid=1;
+  }
+
+  //store the summary of the block that errors are added to, the saved errors mutex must be locked
+  static void err_index_set(const ERROR_BLOCK *blk,SD_block_addr addr){
+    ctl_mutex_lock(&err_index_mutex,CTL_TIMEOUT_NONE,0);
+    err_index_put(blk,addr);
+    err_index_live=blk->number;
+    ctl_mutex_unlock(&err_index_mutex);
+  }
+
+  //forget all block summaries
+  static void err_index_clear(void){
+    ctl_mutex_lock(&err_index_mutex,CTL_TIMEOUT_NONE,0);
+    memset(err_index,0,sizeof(err_index));
+    ctl_mutex_unlock(&err_index_mutex);
+  }
+
+  //add the summary of a block read from the SD card to the index, can be called with the SD card locked
+  static void err_index_fill(const ERROR_BLOCK *blk,SD_block_addr addr){
+    ERR_INDEX_ENT *ent=&err_index[blk->number%ERR_INDEX_SIZE];
+    if(ctl_mutex_lock(&err_index_mutex,CTL_TIMEOUT_NONE,0)){
+      //the current block is newer in RAM, don't replace a newer block with an older one
+      if(blk->number!=err_index_live && (!ent->valid || (short)(blk->number-ent->number)>=0)){
+        err_index_put(blk,addr);
+      }
+      ctl_mutex_unlock(&err_index_mutex);
+    }
+  }
+
+  //get the summary of a block from the index, returns NULL if it is not known
+  static const ERR_SUMMARY *err_index_get(unsigned short number,SD_block_addr addr){
+    const ERR_INDEX_ENT *ent=&err_index[number%ERR_INDEX_SIZE];
+    if(ent->valid && ent->number==number && ent->offset==addr-err_addr_start){
+      return &ent->sum;
+    }
+    return NULL;
   }
 #endif
 
-//start recording of errors
-void error_recording_start(void){
+//check if an error passes a replay filter
+static int err_filter_rec(const ERR_FILTER *filter,const ERR_REC *rec){
+  return rec->dat.level>=filter->level && rec->dat.source>=filter->src_min && rec->dat.source<=filter->src_max &&
+         rec->dat.time>=filter->t_min && (rec->repeat?rec->first:rec->dat.time)<=filter->t_max;
+}
+
+//setup a filter that passes all errors with a level of at least level
+void error_filter_init(ERR_FILTER *filter,unsigned char level){
+  filter->level=level;
+  filter->src_min=0;
+  filter->src_max=0xFFFF;
+  filter->t_min=0;
+  filter->t_max=(ticker)-1;
+}
+
+//convert error slots to a decoded error, info is the repeat information slot for repeated errors or NULL if it was lost
+static void err_dat_to_rec(const ERROR_DAT *dat,const ERROR_DAT *info,ERR_REC *rec){
+  rec->dat=*dat;
+  if(info){
+    rec->repeat=info->argument;
+    rec->first=info->time;
+  }else{
+    rec->repeat=0;
+    rec->first=dat->time;
+  }
+}
+
+//convert a decoded error to error slots, most recent slot first, returns the number of slots used
+static int err_rec_to_dat(const ERR_REC *rec,ERROR_DAT *dest){
+  dest[0]=rec->dat;
+  if(!rec->repeat){
+    return 1;
+  }
+  //add repeat information
+  dest[1]=rec->dat;
+  dest[1].valid=REPEAT_INFO_MAGIC;
+  dest[1].argument=rec->repeat;
+  dest[1].time=rec->first;
+  return 2;
+}
+
+//get the position to start reading errors from RAM with err_ram_prev
+static unsigned short err_ram_first(void){
   #ifdef SD_CARD_OUTPUT
-    int resp,found;
-    SD_block_addr addr,found_addr;
-    ERROR_BLOCK *blk;
-    unsigned char *buf;
-    unsigned short number;
+    return err_dest->used;
+  #else
+    return NUM_ERRORS;
   #endif
-  #ifdef PRINTF_OUTPUT 
-    //print errors that may have occurred during startup
-    int idx,start=next_idx;
-    idx=start;
-    do{
-      //decrement idx
-      idx--;
-      //wrap around
-      if(idx<0){
-        idx=(NUM_ERRORS)-1;
-      }
-      //check if error is valid
-      if(err_dest->saved_errors[idx].valid!=SAVED_ERROR_MAGIC){
-        //error not valid, exit
-        break;
-      }
-      print_error(err_dest->saved_errors[idx].level,err_dest->saved_errors[idx].source,err_dest->saved_errors[idx].err,err_dest->saved_errors[idx].argument,err_dest->saved_errors[idx].time);
-    }while(idx!=start);
+}
+
+#ifndef SD_CARD_OUTPUT
+  //get index of the slot that is pos slots from the oldest slot
+  static int err_ram_idx(unsigned short pos){
+    return (next_idx+pos-1)%NUM_ERRORS;
+  }
+#endif
+
+//read the error before pos from RAM, used to read errors in RAM starting with the most recent
+//returns 0 when there are no more errors
+static int err_ram_prev(unsigned short *pos,ERR_REC *dest){
+  #ifndef SD_CARD_OUTPUT
+    const ERROR_DAT *slot,*info;
   #endif
   #ifdef SD_CARD_OUTPUT
-    resp=mmcInit_card();
-    if(resp==MMC_SUCCESS){
-      //lock card so that we can search uninterrupted
-      resp=mmcLock(CTL_TIMEOUT_DELAY,2048);
-      //check if card was locked
-      if(resp==MMC_SUCCESS){
-        //get buffer 
-        buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
-        //check if buffer acquired
-        if(buf){
-          //look for previous errors on SD card
-          //TODO : add some way to find which error block is most recent
-          for(addr=ERR_ADDR_START,found_addr=0,found=0,number=0;addr<ERR_ADDR_END;addr++){
-            //read block
-            resp=mmcReadBlock(addr,buf);
-            //check for error
-            if(resp==MMC_SUCCESS){
-              //check for valid error block
-              blk=(ERROR_BLOCK*)buf;
-              //check signature values
-              if(blk->sig1==ERROR_BLOCK_SIGNATURE1 && blk->sig2==ERROR_BLOCK_SIGNATURE2){
-                //TODO: check CRC?
-                //check block number is greater then found block
-                if(blk->number>=number){
-                  found_addr=addr;
-                  found=1;
-                  number=blk->number;
-                }
-              }
-            }else{
-                //read failed
-                //TODO: handle error 
-            }
-          }
-        }
-        //TODO: check for errors
-        //check if an address was found
-        if(found){
-          //set error address
-          current_block=found_addr+1;
-          //check for wraparound
-          if(current_block>ERR_ADDR_END){
-            current_block=ERR_ADDR_START;
-          }
-          //set number
-          err_dest->number=number+1;
-        }else{
-          //set address to first address
-          current_block=ERR_ADDR_START;
-          //set number to zero
-          err_dest->number=0;
+    //check for more errors
+    if(*pos==0){
+      return 0;
+    }
+    //find previous error
+    *pos=err_rec_prev(err_dest->data,*pos);
+    //decode error
+    err_rec_decode(err_dest->data,*pos,err_dest->base,dest);
+    return 1;
+  #else
+    //pos counts the slots left to read
+    while(*pos>0){
+      //get slot
+      slot=&err_dest->saved_errors[err_ram_idx(*pos)];
+      (*pos)--;
+      if(slot->valid==SAVED_ERROR_MAGIC){
+        err_dat_to_rec(slot,NULL,dest);
+        return 1;
+      }else if(slot->valid==REPEAT_ERROR_MAGIC){
+        //repeat information is in the slot before
+        info=NULL;
+        if(*pos>0 && err_dest->saved_errors[err_ram_idx(*pos)].valid==REPEAT_INFO_MAGIC){
+          info=&err_dest->saved_errors[err_ram_idx(*pos)];
+          (*pos)--;
         }
-        //done using buffer
-        BUS_free_buffer();
-        //write current block
-        write_error_block(current_block,err_dest);
-        //ready to store errors
-        running=1;
-        //done using card, unlock
-        mmcUnlock();
-      }else{
-        //could not lock SD card
-        //TODO: handle error
+        err_dat_to_rec(slot,info,dest);
+        return 1;
+      }else if(slot->valid!=REPEAT_INFO_MAGIC){
+        //no more errors
+        break;
       }
-    }else{
-      //could not init card
-      //TODO: handle error
+      //repeat information without a repeated error, skip
     }
+    *pos=0;
+    return 0;
   #endif
 }
 
-//set log level that triggers errors to be recorded
-unsigned char set_error_level(unsigned char lev){
-  unsigned char tmp=log_level;
-  log_level=lev;
-  return tmp;
-}
+//number of errors in the report queue, must be a power of two
+#ifndef ERR_QUEUE_SIZE
+  #define ERR_QUEUE_SIZE      (32)
+#endif
+//priority for the logger task
+#ifndef ERR_LOG_PRI
+  #define ERR_LOG_PRI         (30)
+#endif
+//stack size for the logger task
+#ifndef ERR_LOG_STACK
+  #define ERR_LOG_STACK       (256)
+#endif
+//storage for the report queue
+static ERROR_DAT err_queue_buf[ERR_QUEUE_SIZE];
+//queue of reported errors waiting to be recorded
+static ERR_QUEUE err_queue;
+//events for the logger task
+//ERR_LOG_EV_DONE is set by the logger task for report_error_sync and is not waited on by the logger task
+enum{ERR_LOG_EV_QUEUE=1<<0,ERR_LOG_EV_SNAPSHOT=1<<1,ERR_LOG_EV_DONE=1<<2};
+static CTL_EVENT_SET_t err_log_evt;
+//queue index of the next error to be recorded by the logger task, errors before it are recorded and written if they are flushed now
+static volatile unsigned short err_log_done;
+//logger task structure and stack
+static CTL_TASK_t err_log_task;
+static unsigned err_log_stack[ERR_LOG_STACK];
+//output sinks that reported errors are given to, newest first
+static ERR_SINK *volatile err_sinks;
+//events for sink tasks
+enum{ERR_SINK_EV_QUEUE=1<<0};
+#ifdef PRINTF_OUTPUT
+  //number of errors in the print queue, must be a power of two
+  #ifndef ERR_PRINT_QUEUE_SIZE
+    #define ERR_PRINT_QUEUE_SIZE  (16)
+  #endif
+  //priority for the console task
+  #ifndef ERR_PRINT_PRI
+    #define ERR_PRINT_PRI         (5)
+  #endif
+  //stack size for the console task
+  #ifndef ERR_PRINT_STACK
+    #define ERR_PRINT_STACK       (256)
+  #endif
+  //console sink, storage for the print queue and stack for the console task
+  static ERR_SINK err_console;
+  static ERROR_DAT err_print_buf[ERR_PRINT_QUEUE_SIZE];
+  static unsigned err_print_stack[ERR_PRINT_STACK];
+#endif
 
-//get the log level
-unsigned char get_error_level(void){
-  return log_level;
-}    
+//set once the logger task is running
+static short err_log_running;
 
-//record an error without locking, used for init code
-short _record_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
-  //set structures value
-  err_dest->saved_errors[next_idx].level=level;
-  err_dest->saved_errors[next_idx].source=source;
-  err_dest->saved_errors[next_idx].err=err;
-  err_dest->saved_errors[next_idx].argument=argument;
-  err_dest->saved_errors[next_idx].time=time;
-  err_dest->saved_errors[next_idx].valid=SAVED_ERROR_MAGIC;
-  //increment index
-  next_idx++;
-  //wrap around
-  if(next_idx>=(NUM_ERRORS)){
-    next_idx=0;
-    return BLOCK_FULL;
+//number of recent errors checked for repeats
+#ifndef ERR_REPEAT_NUM
+  #define ERR_REPEAT_NUM      (4)
+#endif
+//default time in ticker ticks that an error must repeat within to be counted as a repeat
+#ifndef ERR_REPEAT_WINDOW
+  #define ERR_REPEAT_WINDOW   (1024)
+#endif
+//time in ms between checks for finished repeats
+#ifndef ERR_REPEAT_CHECK
+  #define ERR_REPEAT_CHECK    (1024)
+#endif
+//longest time in ms that report_error_sync waits before checking again in case the logger task wake up was missed
+#ifndef ERR_SYNC_CHECK
+  #define ERR_SYNC_CHECK      (10)
+#endif
+//recent errors, dat.time is the time of the last repeat and repeat is the number of repeats not yet recorded
+static ERR_REC err_repeat[ERR_REPEAT_NUM];
+//repeat window, zero disables repeat counting
+static ticker err_repeat_window;
+
+//statistics for recorded errors, dropped errors are counted by the queues
+static ERR_STATS err_stats;
+
+#ifdef ERR_LATENCY_STATS
+  //timer read to measure latency, must count up at a constant rate
+  #ifndef ERR_LAT_TIMER
+    #define ERR_LAT_TIMER()     (TA0R)
+  #endif
+
+  static ERR_LAT_STATS err_lat;
+
+  //add a time to the latency statistics for a phase, safe to call from interrupts
+  static void err_lat_add(int phase,unsigned short dt){
+    ERR_LAT *lat=&err_lat.phase[phase];
+    unsigned short v;
+    int bin,en;
+    //find histogram bin from the number of significant bits
+    for(bin=0,v=dt;v && bin<ERR_LAT_BINS-1;bin++,v>>=1);
+    en=ctl_global_interrupts_set(0);
+    if(lat->count==0 || dt<lat->min){
+      lat->min=dt;
+    }
+    if(dt>lat->max){
+      lat->max=dt;
+    }
+    lat->count++;
+    lat->total+=dt;
+    if(lat->hist[bin]!=0xFFFF){
+      lat->hist[bin]++;
+    }
+    ctl_global_interrupts_set(en);
   }
-  return BLOCK_NOT_FULL;
-}
 
-//put error data into array but don't do anything
-void record_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
-  short full;
-  //lock saved errors mutex
-  if(ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0)){
-    full=_record_error(level,source,err,argument,time);
-    #ifdef SD_CARD_OUTPUT
-      //check if error code has been initialized
-      if(running){
-        //write block to SD card
-        write_error_block(current_block,err_dest);
-        if(full==BLOCK_FULL){
-          //increment address
-          current_block++;
-          //check for wraparound
-          if(current_block>ERR_ADDR_END){
-            current_block=ERR_ADDR_START;
-          }
-          //clear errors
-          memset(&err_dest->saved_errors,0,sizeof(err_dest->saved_errors));
-          //increment number
-          err_dest->number++;
-        }
-      }
-    #endif
-    //done, unlock saved errors mutex
-    ctl_mutex_unlock(&saved_err_mutex);
+  //count a failure
+  #define ERR_LAT_COUNT(c)    (err_lat.c++)
+#else
+  #define ERR_LAT_COUNT(c)
+#endif
+
+//number of errors kept by the flight recorder, must be a power of two
+#ifndef ERR_FR_SIZE
+  #define ERR_FR_SIZE         (32)
+#endif
+//flight recorder ring, holds the most recent reports of any level
+static ERROR_DAT err_fr_buf[ERR_FR_SIZE];
+//number of reports stored in the ring
+static unsigned short err_fr_head;
+//set when a snapshot has been triggered, the ring is not changed until the snapshot is saved
+static volatile short err_fr_frozen;
+//lowest level stored in the ring and lowest level that triggers a snapshot
+static unsigned char err_fr_level,err_fr_trigger;
+//set once the flight recorder levels have been set, until then the ring follows the log level
+static short err_fr_set;
+#ifdef SD_CARD_OUTPUT
+  //set while recording can still start and save a snapshot that was triggered before it
+  static volatile short err_fr_hold;
+#endif
+
+//lowest level that report_error records or keeps in the flight recorder, checked by the REPORT_ macros
+unsigned char err_report_floor;
+
+//find the lowest level that report_error does anything with, called when any of the levels change
+static void err_floor_update(void){
+  unsigned char lev=(log_level<err_fr_level)?log_level:err_fr_level;
+  int i;
+  for(i=0;i<ERR_SRC_LEVEL_NUM;i++){
+    if(err_src_lev[i]<lev){
+      lev=err_src_lev[i];
+    }
   }
+  err_report_floor=lev;
 }
+#ifdef SD_CARD_OUTPUT
+  //snapshot format version
+  #define ERR_SNAP_VERSION      1
+  //size of the snapshot header
+  #define ERR_SNAP_HEADER_SIZE  (12)
+  //signature for snapshot blocks
+  #define ERR_SNAP_SIGNATURE2   0x5A17
+  //number of errors that fit in a snapshot
+  #define ERR_SNAP_NUM          ((512-ERR_SNAP_HEADER_SIZE-2)/sizeof(ERROR_DAT))
+  //address of a snapshot slot, snapshots are stored at the start of the error region
+  #define ERR_SNAP_ADDR(slot)   (ERR_SNAP_BLOCK(err_region_start,slot))
+  //flight recorder snapshot
+  typedef struct{
+    //magic numbers to identify data from randomness
+    unsigned short sig1,sig2;
+    //snapshot number used to find the most recent snapshot
+    unsigned short number;
+    //snapshot format version
+    unsigned char version;
+    //number of errors in the snapshot
+    unsigned char count;
+    //time of the error that triggered the snapshot
+    ticker time;
+    //errors oldest first stored as ERROR_DAT
+    unsigned char data[512-ERR_SNAP_HEADER_SIZE-2];
+    //CRC of the snapshot
+    unsigned short chk;
+  }ERR_SNAP;
+  //number of the next snapshot and the snapshot slot that it goes in, negative if not known yet
+  static unsigned short err_snap_number;
+  static short err_snap_next;
+#endif
 
-//check error level and return appropriate string
-const char* ERR_lev_str(unsigned char level){
-  if(level<ERR_LEV_INFO){
-    return "Debug";
-  }else if(level<ERR_LEV_WARNING){
-    return "Info";
-  }else if(level<ERR_LEV_ERROR){
-    return "Warning";
-  }else if(level<ERR_LEV_CRITICAL){
+#ifdef SD_CARD_OUTPUT
+  //superblock format version
+  #define ERR_SUPER_VERSION     1
+  //signature for the superblock
+  #define ERR_SUPER_SIGNATURE2  0x5B0C
+  //superblock address, the superblock is the first block of the error region
+  #define ERR_SUPER_ADDR_CUR    (ERR_SUPER_BLOCK(err_region_start))
+  //superblock, holds information about the log that has to survive a reset
+  typedef struct{
+    //magic numbers to identify data from randomness
+    unsigned short sig1,sig2;
+    //superblock format version
+    unsigned char version;
+    //unused, keeps the epoch aligned
+    unsigned char resv;
+    //log epoch, error blocks from other epochs have been cleared
+    unsigned short epoch;
+    //CRC of the fields above
+    unsigned short chk;
+  }ERR_SUPER;
+  //number of bytes covered by the superblock CRC
+  #define ERR_SUPER_CHK_SIZE    (8)
+
+  //check that a superblock is valid
+  static int err_super_ok(const ERR_SUPER *sup){
+    return sup->sig1==ERROR_BLOCK_SIGNATURE1 && sup->sig2==ERR_SUPER_SIGNATURE2 && sup->version==ERR_SUPER_VERSION &&
+           sup->chk==err_crc16(ERR_CRC_INIT,(const unsigned char*)sup,ERR_SUPER_CHK_SIZE);
+  }
+
+  //read the log epoch from the superblock, returns 1 if the superblock is valid
+  static int err_super_read(unsigned char *buf,unsigned short *epoch){
+    ERR_SUPER *sup=(ERR_SUPER*)buf;
+    if(mmcReadBlock(ERR_SUPER_ADDR_CUR,buf)!=MMC_SUCCESS){
+      ERR_LAT_COUNT(sd_fail);
+      return 0;
+    }
+    if(!err_super_ok(sup)){
+      return 0;
+    }
+    *epoch=sup->epoch;
+    return 1;
+  }
+
+  //write the log epoch to the superblock
+  static int err_super_write(unsigned char *buf,unsigned short epoch){
+    ERR_SUPER *sup=(ERR_SUPER*)buf;
+    int resp;
+    memset(buf,0,512);
+    sup->sig1=ERROR_BLOCK_SIGNATURE1;
+    sup->sig2=ERR_SUPER_SIGNATURE2;
+    sup->version=ERR_SUPER_VERSION;
+    sup->epoch=epoch;
+    sup->chk=err_crc16(ERR_CRC_INIT,buf,ERR_SUPER_CHK_SIZE);
+    resp=mmcWriteBlock(ERR_SUPER_ADDR_CUR,buf);
+    if(resp!=MMC_SUCCESS){
+      ERR_LAT_COUNT(sd_fail);
+    }
+    return resp;
+  }
+
+  //find the current log epoch, the log starts at the first block after a clear
+  //so the first block has the newest epoch even if the superblock could not be written
+  static void err_epoch_load(unsigned char *buf){
+    ERROR_BLOCK *blk=(ERROR_BLOCK*)buf;
+    unsigned short epoch=0;
+    err_super_read(buf,&epoch);
+    if(mmcReadBlock(err_addr_start,buf)==MMC_SUCCESS && err_block_format_ok(blk) && err_block_crc_ok(blk) && (short)(blk->epoch-epoch)>0){
+      epoch=blk->epoch;
+    }
+    err_epoch=epoch;
+  }
+#endif
+
+//check an error block from an SD card image, does not depend on the state of the library
+int error_block_info(const unsigned char *buf,ERR_BLK_INFO *info){
+  #ifdef SD_CARD_OUTPUT
+    const ERROR_BLOCK *blk=(const ERROR_BLOCK*)buf;
+    const ERR_SUPER *sup=(const ERR_SUPER*)buf;
+    //check for the superblock
+    if(err_super_ok(sup)){
+      info->number=0;
+      info->epoch=sup->epoch;
+      info->count=0;
+      return ERR_BLK_SUPER;
+    }
+    //check for an error block in any epoch
+    if(!err_block_format_ok(blk)){
+      return ERR_BLK_EMPTY;
+    }
+    info->number=blk->number;
+    info->epoch=blk->epoch;
+    info->count=blk->count;
+    if(!err_block_crc_ok(blk)){
+      return ERR_BLK_BAD_CRC;
+    }
+    return ERR_BLK_OK;
+  #else
+    return ERR_BLK_UNSUPPORTED;
+  #endif
+}
+
+//decode the errors in an error block from an SD card image from oldest to newest
+int error_block_decode(const unsigned char *buf,const ERR_FILTER *filter,ERR_BLK_FUNC func,void *arg){
+  #ifdef SD_CARD_OUTPUT
+    const ERROR_BLOCK *blk=(const ERROR_BLOCK*)buf;
+    unsigned short pos;
+    ERR_REC rec;
+    int n=0;
+    //only decode good blocks
+    if(!err_block_format_ok(blk) || !err_block_crc_ok(blk)){
+      return -1;
+    }
+    //skip blocks that can not match
+    if(filter && !err_sum_match(&blk->sum,filter,err_src_mask(filter->src_min,filter->src_max))){
+      return 0;
+    }
+    for(pos=0;pos<blk->used;){
+      pos=err_rec_decode(blk->data,pos,blk->base,&rec);
+      //check error against filter
+      if(!filter || err_filter_rec(filter,&rec)){
+        func(arg,&rec.dat,rec.repeat,rec.first);
+        n++;
+      }
+    }
+    return n;
+  #else
+    return -1;
+  #endif
+}
+
+
+//setup an error queue
+static void err_queue_init(ERR_QUEUE *q,ERROR_DAT *buf,unsigned short size,CTL_EVENT_SET_t *evt,CTL_EVENT_SET_t ev){
+  q->buf=buf;
+  q->size=size;
+  q->head=q->tail=0;
+  q->dropped=0;
+  q->evt=evt;
+  q->ev=ev;
+}
+
+//get the CRC of the kept errors header and the position of the errors in RAM
+static unsigned short err_keep_chk(void){
+  unsigned short crc=err_crc16(ERR_CRC_INIT,(const unsigned char*)&err_keep,2*sizeof(unsigned short));
+  #ifdef SD_CARD_OUTPUT
+    crc=err_crc16(crc,(const unsigned char*)&err_cur,sizeof(err_cur));
+    crc=err_crc16(crc,(const unsigned char*)&err_pending,sizeof(err_pending));
+    crc=err_crc16(crc,(const unsigned char*)&current_block,sizeof(current_block));
+    crc=err_crc16(crc,(const unsigned char*)err_blk_addr,sizeof(err_blk_addr));
+    //blocks can only be written back to the same region
+    crc=err_crc16(crc,(const unsigned char*)&err_addr_start,sizeof(err_addr_start));
+    crc=err_crc16(crc,(const unsigned char*)&err_addr_end,sizeof(err_addr_end));
+  #else
+    crc=err_crc16(crc,(const unsigned char*)&next_idx,sizeof(next_idx));
+    crc=err_crc16(crc,(const unsigned char*)&err_ram_total,sizeof(err_ram_total));
+  #endif
+  return crc;
+}
+
+//update the kept errors header after the position of the errors in RAM changes, the saved errors mutex must be locked
+static void err_keep_update(void){
+  err_keep.chk=err_keep_chk();
+}
+
+//check if the errors in RAM were kept through a reset
+static int err_keep_valid(void){
+  #ifdef SD_CARD_OUTPUT
+    const ERROR_BLOCK *blk;
+    short i;
+  #endif
+  if(err_keep.magic!=ERR_KEEP_MAGIC || err_keep.chk!=err_keep_chk()){
+    return 0;
+  }
+  #ifdef SD_CARD_OUTPUT
+    if(err_cur<0 || err_cur>=ERR_NUM_BLOCKS || err_pending<0 || err_pending>=ERR_NUM_BLOCKS){
+      return 0;
+    }
+    //check the current block and full blocks waiting to be written, the data CRC is kept up to date as errors are added
+    for(i=0;i<=err_pending;i++){
+      blk=&errors[(err_cur+ERR_NUM_BLOCKS-i)%ERR_NUM_BLOCKS];
+      if(!err_block_format_ok(blk) || blk->dcrc!=err_crc16(ERR_CRC_INIT,blk->data,blk->used)){
+        return 0;
+      }
+    }
+  #else
+    if(next_idx<0 || next_idx>=NUM_ERRORS){
+      return 0;
+    }
+  #endif
+  return 1;
+}
+
+//get the number of warm resets that the errors in RAM have been kept through
+unsigned short error_reset_count(void){
+  return err_keep.resets;
+}
+
+//initialize error reporting system
+void error_init(void){
+  error_init_region(ERR_ADDR_START,ERR_ADDR_END);
+}
+
+//initialize error reporting system with errors stored in blocks start to end
+int error_init_region(unsigned long start,unsigned long end){
+  int ret=RET_SUCCESS;
+  #ifdef SD_CARD_OUTPUT
+    int i;
+  #endif
+  //check that the log after the superblock and the snapshots can hold a few blocks and that block numbers stay in sequence
+  if(end<=ERR_LOG_BLOCK(start) || end-ERR_LOG_BLOCK(start)>=ERR_ADDR_MAX_BLOCKS){
+    start=ERR_ADDR_START;
+    end=ERR_ADDR_END;
+    ret=ERR_INVALID_RANGE;
+  }
+  #ifdef SD_CARD_OUTPUT
+    err_region_start=start;
+    err_addr_start=ERR_LOG_BLOCK(start);
+    err_addr_end=end;
+    err_epoch=0;
+    #ifdef ERR_SD_MULTI_BLOCK
+      err_ra_count=0;
+    #endif
+  #endif
+  //errors from before a warm reset are kept if they are intact
+  if(err_keep_valid()){
+    err_keep.resets++;
+  }else{
+    next_idx=0;
+    memset(&errors,0,sizeof(errors));
+    #ifdef SD_CARD_OUTPUT
+      err_cur=0;
+      err_pending=0;
+      //block has not been placed on the SD card
+      current_block=-1;
+      for(i=0;i<ERR_NUM_BLOCKS;i++){
+        errors[i].sig1=ERROR_BLOCK_SIGNATURE1;
+        errors[i].sig2=ERROR_BLOCK_SIGNATURE2;
+        errors[i].version=ERROR_BLOCK_VERSION;
+        err_block_reset(&errors[i]);
+      }
+    #else
+      err_ram_total=0;
+    #endif
+    err_keep.magic=ERR_KEEP_MAGIC;
+    err_keep.resets=0;
+  }
+  err_keep_update();
+  #ifdef SD_CARD_OUTPUT
+    err_dest=&errors[err_cur];
+    ctl_mutex_init(&err_write_mutex);
+    ctl_mutex_init(&err_index_mutex);
+  #else
+    err_dest=&errors;
+  #endif
+  ctl_mutex_init(&saved_err_mutex);
+  //setup report queue
+  ctl_events_init(&err_log_evt,0);
+  err_queue_init(&err_queue,err_queue_buf,ERR_QUEUE_SIZE,&err_log_evt,ERR_LOG_EV_QUEUE);
+  err_log_done=0;
+  //no output sinks
+  err_sinks=NULL;
+  err_log_running=0;
+  //clear recent errors
+  memset(err_repeat,0,sizeof(err_repeat));
+  err_repeat_window=ERR_REPEAT_WINDOW;
+  //clear statistics
+  memset(&err_stats,0,sizeof(err_stats));
+  //keep the errors that are logged in the flight recorder so filtered reports stay cheap
+  err_fr_head=0;
+  err_fr_frozen=0;
+  err_fr_level=log_level;
+  err_fr_trigger=ERR_LEV_CRITICAL;
+  err_fr_set=0;
+  err_floor_update();
+  #ifdef SD_CARD_OUTPUT
+    err_snap_next=-1;
+    err_fr_hold=1;
+  #endif
+  #ifdef SD_CARD_OUTPUT
+    running=0;
+    err_dirty=0;
+    err_flush_armed=0;
+    err_flush_timeout=ERR_FLUSH_TIMEOUT;
+    err_flush_mode[ERR_STAT_DEBUG]=ERR_FLUSH_MODE_DEBUG;
+    err_flush_mode[ERR_STAT_INFO]=ERR_FLUSH_MODE_INFO;
+    err_flush_mode[ERR_STAT_WARNING]=ERR_FLUSH_MODE_WARNING;
+    err_flush_mode[ERR_STAT_ERROR]=ERR_FLUSH_MODE_ERROR;
+    err_flush_mode[ERR_STAT_CRITICAL]=ERR_FLUSH_MODE_CRITICAL;
+    memset(err_unwritten,0,sizeof(err_unwritten));
+    err_appended=err_blk_writes=0;
+    ctl_events_init(&err_flush_evt,0);
+  #endif
+  return ret;
+}
+  
+#ifdef SD_CARD_OUTPUT
+  //write count blocks that are next to each other in RAM and on the SD card
+  static int write_error_blocks(SD_block_addr addr,ERROR_BLOCK *data,unsigned short count){
+    unsigned short i;
+    int resp;
+    #ifdef ERR_LATENCY_STATS
+      unsigned short start=ERR_LAT_TIMER();
+    #endif
+    for(i=0;i<count;i++){
+      //compute header CRC, the data CRC is kept up to date as errors are added
+      data[i].chk=err_crc16(ERR_CRC_INIT,(unsigned char*)&data[i],ERR_BLOCK_HEADER_SIZE);
+    }
+    //count block writes
+    err_blk_writes+=count;
+    #ifdef ERR_SD_MULTI_BLOCK
+      //blocks that were read ahead may have changed
+      err_sd_gen++;
+      //write blocks
+      if(count>1){
+        resp=mmcWriteMultiBlock(addr,(unsigned char*)data,count);
+      }else{
+        resp=mmcWriteBlock(addr,(unsigned char*)data);
+      }
+    #else
+      //write blocks one at a time
+      for(i=0,resp=MMC_SUCCESS;i<count && resp==MMC_SUCCESS;i++){
+        resp=mmcWriteBlock(addr+i,(unsigned char*)&data[i]);
+      }
+    #endif
+    #ifdef ERR_LATENCY_STATS
+      err_lat_add(ERR_LAT_WRITE,ERR_LAT_TIMER()-start);
+    #endif
+    if(resp!=MMC_SUCCESS){
+      ERR_LAT_COUNT(sd_fail);
+    }else{
+      //errors in the blocks are now on the SD card, blocks are always written from the RAM blocks
+      for(i=0;i<count;i++){
+        err_unwritten[data-errors+i]=0;
+      }
+    }
+    return resp;
+  }
+
+  static int write_error_block(SD_block_addr addr,ERROR_BLOCK *data){
+    return write_error_blocks(addr,data,1);
+  }
+
+  //get the next address in the error region
+  static SD_block_addr err_addr_next(SD_block_addr addr){
+    return (addr>=err_addr_end)?err_addr_start:addr+1;
+  }
+
+  //get the previous address in the error region
+  static SD_block_addr err_addr_prev(SD_block_addr addr){
+    return (addr<=err_addr_start)?err_addr_end:addr-1;
+  }
+
+  //switch to the next RAM block when the current block is full, the saved errors mutex must be locked
+  static void err_block_next(void){
+    unsigned short number=err_dest->number;
+    //save address of the full block
+    err_blk_addr[err_cur]=current_block;
+    //next address with wraparound
+    current_block=err_addr_next(current_block);
+    //switch blocks
+    err_cur=(err_cur+1)%ERR_NUM_BLOCKS;
+    err_dest=&errors[err_cur];
+    //clear errors
+    err_block_reset(err_dest);
+    //increment number
+    err_dest->number=number+1;
+    err_keep_update();
+  }
+
+  //write full blocks that are waiting to be written, oldest first
+  static void err_write_full(void){
+    ERROR_BLOCK *blk;
+    SD_block_addr addr;
+    short idx,n;
+    //only one task writes full blocks at a time
+    ctl_mutex_lock(&err_write_mutex,CTL_TIMEOUT_NONE,0);
+    for(;;){
+      //get the oldest full block
+      ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+      if(!err_pending){
+        ctl_mutex_unlock(&saved_err_mutex);
+        break;
+      }
+      idx=(err_cur+ERR_NUM_BLOCKS-err_pending)%ERR_NUM_BLOCKS;
+      blk=&errors[idx];
+      addr=err_blk_addr[idx];
+      //full blocks that follow in RAM and on the SD card are written together
+      for(n=1;n<err_pending && idx+n<ERR_NUM_BLOCKS && err_blk_addr[idx+n]==addr+n;n++);
+      ctl_mutex_unlock(&saved_err_mutex);
+      //write blocks without holding the saved errors mutex so errors can be added during the write
+      write_error_blocks(addr,blk,n);
+      //blocks can be used again
+      ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+      err_pending-=n;
+      err_keep_update();
+      ctl_mutex_unlock(&saved_err_mutex);
+    }
+    ctl_mutex_unlock(&err_write_mutex);
+  }
+
+  //make room for more errors when the current block is full, the saved errors mutex must be locked
+  //blocks must reach the SD card in order so when there is no free block the older blocks are written first
+  static void err_block_room(void){
+    while(ERR_BLOCK_DATA_SIZE-err_dest->used<ERR_REC_MAX){
+      if(err_flush_timeout!=0 && err_pending<ERR_NUM_BLOCKS-1){
+        //block will be written by the flusher task
+        err_pending++;
+        err_keep_update();
+        //wake up flusher task
+        ctl_events_set_clear(&err_flush_evt,ERR_FLUSH_EV_FULL,0);
+      }else if(err_pending==0){
+        //writing every error, write block to SD card now
+        write_error_block(current_block,err_dest);
+      }else{
+        //no free blocks, the saved errors mutex must be unlocked so the flusher task can finish
+        ctl_mutex_unlock(&saved_err_mutex);
+        err_write_full();
+        ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+        //another task may have switched blocks while the mutex was unlocked
+        continue;
+      }
+      //new block is clean
+      err_dirty=0;
+      err_flush_armed=0;
+      //start adding errors to the next block
+      err_block_next();
+    }
+  }
+
+  //write blocks that were kept through a reset to where they were going to go on the SD card
+  //full blocks are written first so that blocks reach the SD card in order
+  static void err_keep_write(void){
+    //the current block is only placed once recording has started
+    if(current_block<0){
+      return;
+    }
+    err_write_full();
+    //a current block from before a clear is placed as a new block like errors recorded before recording started
+    if(err_dest->used && err_dest->epoch==err_epoch){
+      write_error_block(current_block,err_dest);
+      //start with an empty block
+      err_block_reset(err_dest);
+    }
+  }
+
+
+  //flusher task, writes full blocks and writes dirty blocks to the SD card when they are due
+  static void error_flush_func(void *p){
+    CTL_EVENT_SET_t e;
+    //read the summaries of older blocks while there is nothing to write
+    err_index_build();
+    for(;;){
+      //wait for a full block or for the current block to become dirty
+      e=ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&err_flush_evt,ERR_FLUSH_EV_DIRTY|ERR_FLUSH_EV_FULL,CTL_TIMEOUT_NONE,0);
+      if(e&ERR_FLUSH_EV_DIRTY){
+        //write full blocks while waiting for the block to be due, an error that is due sooner sets the dirty event again
+        do{
+          err_write_full();
+        }while(err_flush_armed && ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&err_flush_evt,ERR_FLUSH_EV_FULL|ERR_FLUSH_EV_DIRTY,CTL_TIMEOUT_ABSOLUTE,err_flush_due));
+        //write block if it has not been written since
+        if(err_flush_armed){
+          error_flush();
+        }
+      }else{
+        err_write_full();
+      }
+    }
+  }
+#endif
+
+//write any errors that are only stored in RAM to the SD card
+int error_flush(void){
+  int resp=RET_SUCCESS;
+  #ifdef SD_CARD_OUTPUT
+    //write full blocks first so that blocks are written in order
+    err_write_full();
+    //lock saved errors mutex
+    if(ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0)){
+      //check if there is anything to write
+      if(running && err_dirty){
+        //write block to SD card
+        resp=write_error_block(current_block,err_dest);
+        //check if write was successful
+        if(resp==MMC_SUCCESS){
+          //block is now clean
+          err_dirty=0;
+          err_flush_armed=0;
+        }
+      }
+      //done, unlock saved errors mutex
+      ctl_mutex_unlock(&saved_err_mutex);
+    }
+  #endif
+  return resp;
+}
+
+//set the time in ms that errors can stay in RAM before being written to the SD card
+CTL_TIME_t set_error_flush_timeout(CTL_TIME_t timeout){
+  #ifdef SD_CARD_OUTPUT
+    CTL_TIME_t tmp=err_flush_timeout;
+    err_flush_timeout=timeout;
+    return tmp;
+  #else
+    return 0;
+  #endif
+}
+
+//set how errors in a level class are written to the SD card
+int set_error_flush_mode(int cls,int mode){
+  #ifdef SD_CARD_OUTPUT
+    int tmp;
+  #endif
+  if(cls<0 || cls>=ERR_STAT_LEVELS || mode<ERR_FLUSH_NOW || mode>ERR_FLUSH_FULL){
+    return -1;
+  }
+  #ifdef SD_CARD_OUTPUT
+    tmp=err_flush_mode[cls];
+    err_flush_mode[cls]=mode;
+    return tmp;
+  #else
+    //printed errors are not buffered
+    return ERR_FLUSH_NOW;
+  #endif
+}
+
+//get how far the SD card is behind the errors that have been reported
+void error_flush_lag(ERR_FLUSH_LAG *lag){
+  #ifdef SD_CARD_OUTPUT
+    CTL_TIME_t now;
+    short i,idx;
+  #endif
+  //errors that the logger task has not recorded yet
+  lag->queued=err_queue.head-err_queue.tail;
+  lag->unwritten=0;
+  lag->age=0;
+  lag->due=ERR_FLUSH_NOT_DUE;
+  #ifdef SD_CARD_OUTPUT
+    if(ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0)){
+      now=ctl_get_current_time();
+      //go through full blocks and the current block from oldest to newest
+      for(i=err_pending;i>=0;i--){
+        idx=(err_cur+ERR_NUM_BLOCKS-i)%ERR_NUM_BLOCKS;
+        if(err_unwritten[idx]){
+          //the first block with errors in RAM has the oldest error
+          if(!lag->unwritten){
+            lag->age=now-err_unwritten_time[idx];
+          }
+          lag->unwritten+=err_unwritten[idx];
+        }
+      }
+      //time until the flusher task writes the current block
+      if(err_flush_armed){
+        lag->due=((long)(err_flush_due-now)>0)?err_flush_due-now:0;
+      }
+      ctl_mutex_unlock(&saved_err_mutex);
+    }
+  #endif
+}
+
+//get the number of SD card writes and the number of writes saved by buffering errors
+void error_flush_stats(unsigned long *writes,unsigned long *saved){
+  #ifdef SD_CARD_OUTPUT
+    *writes=err_blk_writes;
+    //every error used to cost a block write
+    *saved=(err_appended>err_blk_writes)?(err_appended-err_blk_writes):0;
+  #else
+    *writes=0;
+    *saved=0;
+  #endif
+}
+
+#ifdef SD_CARD_OUTPUT
+  //read an error block from the SD card and check the signature and optionally the CRC
+  //returns 1 if the block is valid
+  static int err_read_block(SD_block_addr addr,unsigned char *buf,int check_crc){
+    ERROR_BLOCK *blk=(ERROR_BLOCK*)buf;
+    //read block
+    if(mmcReadBlock(addr,buf)!=MMC_SUCCESS){
+      //read failed
+      ERR_LAT_COUNT(sd_fail);
+      return 0;
+    }
+    //check header values
+    if(!err_block_header_ok(blk)){
+      return 0;
+    }
+    //check CRC
+    if(check_crc && !err_block_crc_ok(blk)){
+      return 0;
+    }
+    return 1;
+  }
+
+  //read a block for a replay, the SD card must be locked
+  //replays go from newer to older blocks so older blocks that the filter needs are read at the same time
+  static int err_read_back(SD_block_addr addr,unsigned short number,const ERR_FILTER *filter,unsigned short src_mask,unsigned char *buf){
+    #ifdef ERR_SD_MULTI_BLOCK
+      const ERR_SUMMARY *sum;
+      unsigned short n,gen;
+      int resp;
+      //use blocks that were read ahead if nothing has been written since
+      if(err_ra_count && err_ra_gen==err_sd_gen && addr>=err_ra_addr && addr<err_ra_addr+err_ra_count){
+        memcpy(buf,err_ra_buf+(addr-err_ra_addr)*512,512);
+        return MMC_SUCCESS;
+      }
+      //count older blocks to read without going past the start of the region or the start of the log
+      for(n=1;n<ERR_READ_AHEAD && n<=addr-err_addr_start && n<=number;n++){
+        //stop at blocks that the filter would skip
+        sum=err_index_get(number-n,addr-n);
+        if(sum && !err_sum_match(sum,filter,src_mask)){
+          break;
+        }
+      }
+      if(n==1){
+        return mmcReadBlock(addr,buf);
+      }
+      gen=err_sd_gen;
+      resp=mmcReadBlocks(addr-(n-1),n,err_ra_buf);
+      if(resp!=MMC_SUCCESS){
+        err_ra_count=0;
+        return resp;
+      }
+      err_ra_addr=addr-(n-1);
+      err_ra_count=n;
+      err_ra_gen=gen;
+      memcpy(buf,err_ra_buf+(n-1)*512,512);
+      return MMC_SUCCESS;
+    #else
+      return mmcReadBlock(addr,buf);
+    #endif
+  }
+
+  //look at every block in the error region to find the most recent one
+  //this is slow and only used when the log looks corrupted
+  static int err_scan_head(unsigned char *buf,SD_block_addr *head,unsigned short *number){
+    ERROR_BLOCK *blk=(ERROR_BLOCK*)buf;
+    SD_block_addr addr;
+    int found;
+    for(addr=err_addr_start,found=0,*number=0;addr<=err_addr_end;addr++){
+      //read block and check for valid error block
+      if(err_read_block(addr,buf,1)){
+        //check block number is after the found block, numbers in the region are less than half the number range apart
+        if(!found || (short)(blk->number-*number)>0){
+          *head=addr;
+          found=1;
+          *number=blk->number;
+        }
+      }
+    }
+    return found;
+  }
+
+  //find the most recent error block
+  //blocks are written in order starting at the start of the region so the block numbers increase by one for each block until the
+  //most recent block is reached. This allows the most recent block to be found with a binary search
+  static int err_find_head(unsigned char *buf,SD_block_addr *head,unsigned short *number){
+    ERROR_BLOCK *blk=(ERROR_BLOCK*)buf;
+    SD_block_addr lo,hi,mid;
+    unsigned short first;
+    //the log starts at the first block, if it is not valid the log is empty or corrupted
+    if(!err_read_block(err_addr_start,buf,1)){
+      //a good block from an older epoch means the log was cleared and nothing has been written since
+      if(mmcReadBlock(err_addr_start,buf)==MMC_SUCCESS && err_block_format_ok(blk) && err_block_crc_ok(blk)){
+        return 0;
+      }
+      //search the whole region to be sure
+      return err_scan_head(buf,head,number);
+    }
+    //get number of the first block
+    first=blk->number;
+    //find the last block that continues the sequence from the first block
+    for(lo=err_addr_start,hi=err_addr_end+1;hi-lo>1;){
+      mid=lo+(hi-lo)/2;
+      if(err_read_block(mid,buf,0) && blk->number==(unsigned short)(first+(mid-err_addr_start))){
+        //block is at or before the head
+        lo=mid;
+      }else{
+        //block is after the head
+        hi=mid;
+      }
+    }
+    //check CRC of the found block
+    if(!err_read_block(lo,buf,1)){
+      //block is corrupted, search the whole region
+      return err_scan_head(buf,head,number);
+    }
+    *head=lo;
+    *number=blk->number;
+    //the block after the head must be unused or one trip around the region older
+    if(lo<err_addr_end && err_read_block(lo+1,buf,0) && (unsigned short)(*number-blk->number)!=ERR_REGION_SIZE-1){
+      //blocks are out of sequence, search the whole region
+      return err_scan_head(buf,head,number);
+    }
+    return 1;
+  }
+
+  //fill in the index with the summaries of blocks that are already on the SD card
+  //this is done from the flusher task so that startup is not slowed down by reading the whole log
+  static void err_index_build(void){
+    ERROR_BLOCK *blk;
+    SD_block_addr addr;
+    unsigned short number;
+    unsigned char *buf;
+    int i,found;
+    //start from the current block
+    ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+    addr=current_block;
+    number=err_dest->number;
+    ctl_mutex_unlock(&saved_err_mutex);
+    for(i=1;i<ERR_INDEX_SIZE && i<ERR_REGION_SIZE;i++){
+      //get previous block
+      addr=err_addr_prev(addr);
+      number--;
+      //lock card for each block so that other users are not held up
+      if(mmcLock(CTL_TIMEOUT_DELAY,2048)!=MMC_SUCCESS){
+        ERR_LAT_COUNT(timeouts);
+        return;
+      }
+      buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+      found=0;
+      if(buf){
+        blk=(ERROR_BLOCK*)buf;
+        //check for the expected block
+        if(err_read_block(addr,buf,1) && blk->number==number){
+          err_index_fill(blk,addr);
+          found=1;
+        }
+        BUS_free_buffer();
+      }
+      mmcUnlock();
+      //stop at the start of the log
+      if(!found){
+        return;
+      }
+    }
+  }
+#endif
+
+//start recording of errors
+int error_recording_start(void){
+  int resp=RET_SUCCESS;
+  #ifdef SD_CARD_OUTPUT
+    int found,i;
+    SD_block_addr found_addr;
+    unsigned char *buf;
+    unsigned short number;
+  #endif
+  #ifdef PRINTF_OUTPUT 
+    //print errors that may have occurred during startup
+    ERR_REC rec;
+    unsigned short pos=err_ram_first();
+    while(err_ram_prev(&pos,&rec)){
+      print_rec(&rec,0);
+    }
+  #endif
+  //start logger task
+  if(!err_log_running){
+    err_log_running=1;
+    ctl_task_run(&err_log_task,ERR_LOG_PRI,error_log_func,NULL,"err_log",sizeof(err_log_stack)/sizeof(err_log_stack[0])-2,err_log_stack+1,0);
+    #ifdef PRINTF_OUTPUT
+      //print errors from a console sink
+      error_sink_add(&err_console,"err_print",ERR_LEV_DEBUG,error_sink_print,NULL,err_print_buf,ERR_PRINT_QUEUE_SIZE,ERR_PRINT_PRI,err_print_stack,ERR_PRINT_STACK);
+    #endif
+  }
+  #ifdef SD_CARD_OUTPUT
+    //nothing to do if an earlier call started recording
+    if(running){
+      return RET_SUCCESS;
+    }
+    //a snapshot that is triggered while recording starts is saved once it has started
+    err_fr_hold=1;
+    resp=mmcInit_card();
+    if(resp==MMC_SUCCESS){
+      //hold off block writes and errors from other tasks until the SD card position is set
+      ctl_mutex_lock(&err_write_mutex,CTL_TIMEOUT_NONE,0);
+      ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+      //lock card so that we can search uninterrupted
+      resp=mmcLock(CTL_TIMEOUT_DELAY,2048);
+      //check if card was locked
+      if(resp==MMC_SUCCESS){
+        //get buffer, the log can't be searched without it so try again if the bus is busy
+        for(i=0,buf=NULL;!buf && i<ERR_START_BUF_TRIES;i++){
+          buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+        }
+        //check if buffer acquired
+        if(buf){
+          //get the log epoch so that cleared blocks are ignored
+          err_epoch_load(buf);
+          //finish writing blocks that were kept through a reset so they are part of the log
+          err_keep_write();
+          //look for previous errors on SD card
+          found=err_find_head(buf,&found_addr,&number);
+          //check if an address was found
+          if(found){
+            //set error address after the found block
+            current_block=err_addr_next(found_addr);
+            //set number
+            err_dest->number=number+1;
+          }else{
+            //set address to first address
+            current_block=err_addr_start;
+            //set number to zero
+            err_dest->number=0;
+          }
+          //errors recorded before the SD card was setup go in the current epoch
+          err_dest->epoch=err_epoch;
+          //forget summaries from before the block was placed and add the current block
+          err_index_clear();
+          err_index_set(err_dest,current_block);
+          err_keep_update();
+          //done using buffer
+          BUS_free_buffer();
+          //write current block
+          write_error_block(current_block,err_dest);
+          //ready to store errors
+          running=1;
+          //save snapshot that was triggered before recording started
+          if(err_fr_frozen){
+            ctl_events_set_clear(&err_log_evt,ERR_LOG_EV_SNAPSHOT,0);
+          }
+          //start flusher task
+          ctl_task_run(&err_flush_task,ERR_FLUSH_PRI,error_flush_func,NULL,"err_flush",sizeof(err_flush_stack)/sizeof(err_flush_stack[0])-2,err_flush_stack+1,0);
+        }else{
+          //without a buffer the newest block is not known and picking an address could overwrite the log
+          //errors stay in RAM until recording is started again
+          resp=ERR_BUSY;
+          ERR_LAT_COUNT(timeouts);
+        }
+        //done using card, unlock
+        mmcUnlock();
+      }else{
+        //could not lock SD card
+        ERR_LAT_COUNT(timeouts);
+      }
+      ctl_mutex_unlock(&saved_err_mutex);
+      ctl_mutex_unlock(&err_write_mutex);
+    }else{
+      //could not init card
+      ERR_LAT_COUNT(sd_fail);
+    }
+    if(!running){
+      //no card to save a snapshot to, let the flight recorder run again
+      err_fr_hold=0;
+      err_fr_frozen=0;
+    }
+  #endif
+  return resp;
+}
+
+//set log level that triggers errors to be recorded
+unsigned char set_error_level(unsigned char lev){
+  unsigned char tmp=log_level;
+  int i;
+  log_level=lev;
+  //flight recorder follows the log level until it is set
+  if(!err_fr_set){
+    err_fr_level=lev;
+  }
+  //update sources that follow the log level
+  for(i=0;i<ERR_SRC_LEVEL_NUM;i++){
+    if(!(err_src_set[i/8]&(1<<(i%8)))){
+      err_src_lev[i]=lev;
+    }
+  }
+  err_floor_update();
+  return tmp;
+}
+
+//get the log level
+unsigned char get_error_level(void){
+  return log_level;
+}
+
+//get the level that an error from source must meet to be recorded
+static unsigned char err_src_threshold(unsigned short source){
+  unsigned short idx=source>>ERR_SRC_LEVEL_SHIFT;
+  return (idx<ERR_SRC_LEVEL_NUM)?err_src_lev[idx]:log_level;
+}
+
+//set the level that errors from a range of sources must meet to be recorded
+//returns the old level for min or ERR_INVALID_RANGE if the range is not in the table
+int set_error_source_level(unsigned short min,unsigned short max,unsigned char lev){
+  unsigned short i,last=max>>ERR_SRC_LEVEL_SHIFT;
+  int tmp;
+  //check range
+  if(min>max || (min>>ERR_SRC_LEVEL_SHIFT)>=ERR_SRC_LEVEL_NUM){
+    return -ERR_INVALID_RANGE;
+  }
+  //sources past the end of the table follow the log level
+  if(last>=ERR_SRC_LEVEL_NUM){
+    last=ERR_SRC_LEVEL_NUM-1;
+  }
+  tmp=err_src_lev[min>>ERR_SRC_LEVEL_SHIFT];
+  for(i=min>>ERR_SRC_LEVEL_SHIFT;i<=last;i++){
+    err_src_lev[i]=lev;
+    err_src_set[i/8]|=1<<(i%8);
+  }
+  err_floor_update();
+  return tmp;
+}
+
+//make a range of sources follow the log level again
+void clear_error_source_level(unsigned short min,unsigned short max){
+  unsigned short i,last=max>>ERR_SRC_LEVEL_SHIFT;
+  if(last>=ERR_SRC_LEVEL_NUM){
+    last=ERR_SRC_LEVEL_NUM-1;
+  }
+  for(i=min>>ERR_SRC_LEVEL_SHIFT;i<=last && min<=max;i++){
+    err_src_lev[i]=log_level;
+    err_src_set[i/8]&=~(1<<(i%8));
+  }
+  err_floor_update();
+}
+
+//get the level that errors from source must meet to be recorded
+unsigned char get_error_source_level(unsigned short source){
+  return err_src_threshold(source);
+}
+
+//save the source level table
+void save_error_source_levels(ERR_SRC_LEVELS *dest){
+  memcpy(dest->level,err_src_lev,sizeof(dest->level));
+  memcpy(dest->set,err_src_set,sizeof(dest->set));
+}
+
+//restore a saved source level table, sources that were not set follow the current log level
+void restore_error_source_levels(const ERR_SRC_LEVELS *src){
+  int i;
+  memcpy(err_src_set,src->set,sizeof(err_src_set));
+  for(i=0;i<ERR_SRC_LEVEL_NUM;i++){
+    err_src_lev[i]=(err_src_set[i/8]&(1<<(i%8)))?src->level[i]:log_level;
+  }
+  err_floor_update();
+}    
+
+//fill in a decoded error for a single error
+static void err_rec_set(ERR_REC *rec,unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  rec->dat.level=level;
+  rec->dat.source=source;
+  rec->dat.err=err;
+  rec->dat.argument=argument;
+  rec->dat.time=time;
+  rec->dat.valid=SAVED_ERROR_MAGIC;
+  rec->repeat=0;
+  rec->first=0;
+}
+
+#ifndef SD_CARD_OUTPUT
+  //put error slot into the RAM ring
+  static short err_ram_put(const ERROR_DAT *dat){
+    err_dest->saved_errors[next_idx]=*dat;
+    err_ram_total++;
+    //increment index
+    next_idx++;
+    //wrap around
+    if(next_idx>=(NUM_ERRORS)){
+      next_idx=0;
+      return BLOCK_FULL;
+    }
+    return BLOCK_NOT_FULL;
+  }
+#endif
+
+//record a decoded error without locking
+static short _record_rec(const ERR_REC *rec){
+  #ifdef SD_CARD_OUTPUT
+    unsigned short len;
+    //blocks are only switched once recording has started, before that start over when the block is full
+    if(ERR_BLOCK_DATA_SIZE-err_dest->used<ERR_REC_MAX){
+      err_block_reset(err_dest);
+    }
+    //first error in the block sets the base time
+    if(err_dest->count==0){
+      err_dest->base=rec->repeat?rec->first:rec->dat.time;
+    }
+    //encode error, there is always room for one more
+    len=err_rec_encode(err_dest->data+err_dest->used,rec,err_dest->base);
+    //add new data to the data CRC
+    err_dest->dcrc=err_crc16(err_dest->dcrc,err_dest->data+err_dest->used,len);
+    err_dest->used+=len;
+    err_dest->count++;
+    //update block summary and the index
+    err_sum_add(&err_dest->sum,rec);
+    err_index_set(err_dest,current_block);
+    next_idx=err_dest->count;
+    //check if there is room for another error
+    if(ERR_BLOCK_DATA_SIZE-err_dest->used<ERR_REC_MAX){
+      next_idx=0;
+      return BLOCK_FULL;
+    }
+    return BLOCK_NOT_FULL;
+  #else
+    ERROR_DAT slots[2];
+    short full=BLOCK_NOT_FULL;
+    //store slots oldest first
+    if(err_rec_to_dat(rec,slots)==2){
+      full=err_ram_put(&slots[1]);
+    }
+    if(err_ram_put(&slots[0])==BLOCK_FULL){
+      full=BLOCK_FULL;
+    }
+    err_keep_update();
+    return full;
+  #endif
+}
+
+//record an error without locking, used for init code
+short _record_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  ERR_REC rec;
+  err_rec_set(&rec,level,source,err,argument,time);
+  return _record_rec(&rec);
+}
+
+//get the statistics level class for a level
+static int err_stat_class(unsigned char level){
+  if(level<ERR_LEV_INFO){
+    return ERR_STAT_DEBUG;
+  }else if(level<ERR_LEV_WARNING){
+    return ERR_STAT_INFO;
+  }else if(level<ERR_LEV_ERROR){
+    return ERR_STAT_WARNING;
+  }else if(level<ERR_LEV_CRITICAL){
+    return ERR_STAT_ERROR;
+  }else{
+    return ERR_STAT_CRITICAL;
+  }
+}
+
+#ifdef SD_CARD_OUTPUT
+  //count a log block skipped by a replay, replays hold the SD card so interrupts are disabled instead of locking the saved errors mutex
+  static void err_bad_block(void){
+    int en=ctl_global_interrupts_set(0);
+    err_stats.bad_blocks++;
+    ctl_global_interrupts_set(en);
+  }
+#endif
+
+//add a recorded error to the statistics, the saved errors mutex must be locked
+static void err_stat_add(const ERR_REC *rec){
+  ERR_STAT_SRC *min=&err_stats.top[0];
+  unsigned short n=rec->repeat?rec->repeat:1;
+  unsigned long total;
+  int i;
+  //check for first error
+  total=0;
+  for(i=0;i<ERR_STAT_LEVELS;i++){
+    total+=err_stats.levels[i];
+  }
+  if(total==0){
+    err_stats.first=rec->repeat?rec->first:rec->dat.time;
+  }
+  err_stats.last=rec->dat.time;
+  err_stats.levels[err_stat_class(rec->dat.level)]+=n;
+  //count source, keep the sources with the highest counts using the space saving algorithm
+  for(i=0;i<ERR_STAT_TOP;i++){
+    if(err_stats.top[i].count && err_stats.top[i].source==rec->dat.source){
+      //source found, add to count
+      min=&err_stats.top[i];
+      break;
+    }
+    if(err_stats.top[i].count<min->count){
+      min=&err_stats.top[i];
+    }
+  }
+  if(i==ERR_STAT_TOP){
+    //source not found, replace the source with the lowest count
+    //the new source could have been seen as many times as the source it replaces
+    min->source=rec->dat.source;
+    min->over=min->count;
+  }
+  //add to count without overflowing
+  min->count=(0xFFFF-min->count<n)?0xFFFF:min->count+n;
+}
+
+//put decoded error into storage and write to the SD card if needed
+static void record_rec(const ERR_REC *rec){
+  #ifdef SD_CARD_OUTPUT
+    short full;
+    CTL_TIME_t now,due;
+    int mode,sync=0;
+  #endif
+  #ifdef ERR_LATENCY_STATS
+    unsigned short start=ERR_LAT_TIMER();
+  #endif
+  //lock saved errors mutex
+  if(ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0)){
+    #ifdef ERR_LATENCY_STATS
+      err_lat_add(ERR_LAT_MUTEX,ERR_LAT_TIMER()-start);
+    #endif
+    //update statistics
+    err_stat_add(rec);
+    #ifdef SD_CARD_OUTPUT
+      //the block can be full if another task is waiting for blocks to be written
+      if(running){
+        err_block_room();
+      }
+      full=_record_rec(rec);
+      //check if error code has been initialized
+      if(running){
+        //count errors for write statistics
+        err_appended++;
+        now=ctl_get_current_time();
+        //count errors that are only in RAM
+        if(!err_unwritten[err_cur]){
+          err_unwritten_time[err_cur]=now;
+        }
+        err_unwritten[err_cur]++;
+        mode=err_flush_mode[err_stat_class(rec->dat.level)];
+        //zero timeout writes every error
+        if(mode==ERR_FLUSH_DELAY && err_flush_timeout==0){
+          mode=ERR_FLUSH_NOW;
+        }
+        //error and any full blocks before it are written once the mutex is unlocked
+        sync=(mode==ERR_FLUSH_NOW);
+        if(full==BLOCK_FULL){
+          //write the block or give it to the flusher task and start adding errors to the next block
+          err_block_room();
+        }else{
+          err_dirty=1;
+          if(mode==ERR_FLUSH_DELAY){
+            due=now+err_flush_timeout;
+            //check if the block has to be written sooner than it was going to be
+            if(!err_flush_armed || (long)(due-err_flush_due)<0){
+              err_flush_due=due;
+              err_flush_armed=1;
+              //wake up flusher task
+              ctl_events_set_clear(&err_flush_evt,ERR_FLUSH_EV_DIRTY,0);
+            }
+          }
+        }
+      }
+    #else
+      _record_rec(rec);
+    #endif
+    //done, unlock saved errors mutex
+    ctl_mutex_unlock(&saved_err_mutex);
+    #ifdef SD_CARD_OUTPUT
+      //full blocks have to be written first which needs the mutex to be unlocked
+      if(sync){
+        error_flush();
+      }
+    #endif
+  }else{
+    //could not lock mutex, error is lost
+    ERR_LAT_COUNT(timeouts);
+  }
+}
+
+//put error data into array but don't do anything
+void record_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  ERR_REC rec;
+  err_rec_set(&rec,level,source,err,argument,time);
+  record_rec(&rec);
+}
+
+//check error level and return appropriate string
+const char* ERR_lev_str(unsigned char level){
+  if(level<ERR_LEV_INFO){
+    return "Debug";
+  }else if(level<ERR_LEV_WARNING){
+    return "Info";
+  }else if(level<ERR_LEV_ERROR){
+    return "Warning";
+  }else if(level<ERR_LEV_CRITICAL){
     return "Error";
   }else{
     return "Critical Error";
   }
 }
 
-const char *err_do_decode(char buf[150],unsigned short source,int err, unsigned short argument,unsigned short flags){
-  int i;
-  //check for matching handler
-  for(i=0;i<err_next_decode;i++){
-    //check if range and flags are a match
-    if(((!flags) || (decode_tbl[i].flags&flags)) && (decode_tbl[i].min<=source && decode_tbl[i].max>=source)){
-      //call error handler
-      return decode_tbl[i].decode(buf,source,err,argument);
+const char *err_do_decode(char buf[150],unsigned short source,int err, unsigned short argument,unsigned short flags){
+  int i;
+  //find the handler whose range could contain source
+  i=err_decode_search(source)-1;
+  //check if range and flags are a match
+  if(i>=0 && decode_tbl[i].max>=source && ((!flags) || (decode_tbl[i].flags&flags))){
+    //call error handler
+    return decode_tbl[i].decode(buf,source,err,argument);
+  }
+  //source unknown, return string with error numbers
+  sprintf(buf,"Unknown Source : source = %u, error = %u, argument = %u",source,err,argument);
+  //return buffer
+  return buf;
+}
+
+//print an error
+void print_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  char buf[150];
+  const char *lev_str;
+  #ifdef ERR_LATENCY_STATS
+    unsigned short start=ERR_LAT_TIMER();
+  #endif
+  //check error level and use appropriate string
+  lev_str=ERR_lev_str(level);
+  //print message
+  printf("%10lu:%-14s (%3i) : %s\r\n",(unsigned long)time,lev_str,level,err_do_decode(buf,source,err,argument,0));
+  #ifdef ERR_LATENCY_STATS
+    err_lat_add(ERR_LAT_PRINT,ERR_LAT_TIMER()-start);
+  #endif
+}
+
+//print a decoded error, flags are passed to the decode function
+static void print_rec(const ERR_REC *rec,unsigned short flags){
+  char buf[150];
+  #ifdef ERR_LATENCY_STATS
+    unsigned short start=ERR_LAT_TIMER();
+  #endif
+  //check for repeated error
+  if(rec->dat.valid==REPEAT_ERROR_MAGIC){
+    printf("%10lu:%-14s (%3i) : repeated x%u since %lu : %s\r\n",(unsigned long)rec->dat.time,ERR_lev_str(rec->dat.level),rec->dat.level,rec->repeat,(unsigned long)rec->first,err_do_decode(buf,rec->dat.source,rec->dat.err,rec->dat.argument,flags));
+  }else{
+    printf("%10lu:%-14s (%3i) : %s\r\n",(unsigned long)rec->dat.time,ERR_lev_str(rec->dat.level),rec->dat.level,err_do_decode(buf,rec->dat.source,rec->dat.err,rec->dat.argument,flags));
+  }
+  #ifdef ERR_LATENCY_STATS
+    err_lat_add(ERR_LAT_PRINT,ERR_LAT_TIMER()-start);
+  #endif
+}
+
+//add an error to a queue, safe to call from interrupts
+static void err_queue_put(ERR_QUEUE *q,unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  ERROR_DAT *dat;
+  int en;
+  //disable interrupts while the queue slot is filled
+  en=ctl_global_interrupts_set(0);
+  //check for room in the queue
+  if((unsigned short)(q->head-q->tail)>=q->size){
+    //queue is full, count dropped error
+    q->dropped++;
+    //restore interrupts
+    ctl_global_interrupts_set(en);
+    return;
+  }
+  //get slot
+  dat=&q->buf[q->head&(q->size-1)];
+  //set structures value
+  dat->level=level;
+  dat->source=source;
+  dat->err=err;
+  dat->argument=argument;
+  dat->time=time;
+  dat->valid=SAVED_ERROR_MAGIC;
+  //publish entry
+  q->head++;
+  //restore interrupts
+  ctl_global_interrupts_set(en);
+  //wake up task
+  ctl_events_set_clear(q->evt,q->ev,0);
+}
+
+//get an error from a queue, only called from the task that owns the queue
+static int err_queue_get(ERR_QUEUE *q,ERROR_DAT *dest){
+  //check for queued errors
+  if(q->tail==q->head){
+    return 0;
+  }
+  //copy error out of the queue
+  *dest=q->buf[q->tail&(q->size-1)];
+  //free slot
+  q->tail++;
+  return 1;
+}
+
+//get the number of errors dropped by a queue
+static unsigned long err_queue_dropped(ERR_QUEUE *q){
+  unsigned long ret;
+  int en;
+  //disable interrupts so that the count is read in one piece
+  en=ctl_global_interrupts_set(0);
+  ret=q->dropped;
+  //restore interrupts
+  ctl_global_interrupts_set(en);
+  return ret;
+}
+
+//record repeats of a recent error that have not been recorded
+static void err_repeat_record(ERR_REC *rec){
+  ERR_REC tmp;
+  if(rec->repeat){
+    tmp=*rec;
+    tmp.dat.valid=REPEAT_ERROR_MAGIC;
+    record_rec(&tmp);
+    rec->repeat=0;
+  }
+}
+
+//check if an error repeats a recent error, returns 1 if the error was counted as a repeat and should not be recorded
+static int err_repeat_check(const ERROR_DAT *dat){
+  ERR_REC *rec,*old;
+  int i;
+  //check if repeat counting is enabled
+  if(!err_repeat_window){
+    return 0;
+  }
+  for(i=0,rec=err_repeat,old=err_repeat;i<ERR_REPEAT_NUM;i++,rec++){
+    //check for matching error
+    if(rec->dat.valid && rec->dat.level==dat->level && rec->dat.source==dat->source && rec->dat.err==dat->err && rec->dat.argument==dat->argument){
+      //check if error is within the repeat window
+      if((ticker)(dat->time-rec->dat.time)<=err_repeat_window){
+        //check if this is the first repeat
+        if(!rec->repeat){
+          rec->first=dat->time;
+        }
+        rec->repeat++;
+        rec->dat.time=dat->time;
+        //record repeats before the count overflows
+        if(rec->repeat==0xFFFF){
+          err_repeat_record(rec);
+        }
+        return 1;
+      }
+      //too long since the last repeat, record repeats and start over with this error
+      err_repeat_record(rec);
+      rec->dat.time=dat->time;
+      return 0;
+    }
+    //find the least recently seen error
+    if(old->dat.valid && (!rec->dat.valid || (ticker)(dat->time-rec->dat.time)>(ticker)(dat->time-old->dat.time))){
+      old=rec;
+    }
+  }
+  //replace least recently seen error
+  err_repeat_record(old);
+  old->dat=*dat;
+  old->repeat=0;
+  return 0;
+}
+
+//record repeats that are finished, returns 1 if there are repeats that have not been recorded
+static int err_repeat_expire(void){
+  ticker now=get_ticker_time();
+  int i,pending=0;
+  for(i=0;i<ERR_REPEAT_NUM;i++){
+    if(err_repeat[i].repeat){
+      //check if the repeat window has passed
+      if((ticker)(now-err_repeat[i].dat.time)>err_repeat_window){
+        err_repeat_record(&err_repeat[i]);
+      }else{
+        pending=1;
+      }
+    }
+  }
+  return pending;
+}
+
+//set the time in ticker ticks that an error has to repeat within to be counted instead of recorded, zero disables repeat counting
+ticker set_error_repeat_window(ticker window){
+  ticker tmp=err_repeat_window;
+  err_repeat_window=window;
+  return tmp;
+}
+
+//add a report to the flight recorder, safe to call from interrupts
+static void err_fr_put(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
+  ERROR_DAT *dat;
+  int en;
+  //check level
+  if(level<err_fr_level || err_fr_level==ERR_FR_OFF){
+    return;
+  }
+  //disable interrupts while the slot is filled
+  en=ctl_global_interrupts_set(0);
+  //ring is not changed while a snapshot is waiting to be saved
+  if(!err_fr_frozen){
+    dat=&err_fr_buf[err_fr_head&(ERR_FR_SIZE-1)];
+    dat->level=level;
+    dat->source=source;
+    dat->err=err;
+    dat->argument=argument;
+    dat->time=time;
+    dat->valid=SAVED_ERROR_MAGIC;
+    err_fr_head++;
+    //check for snapshot trigger
+    if(level>=err_fr_trigger){
+      //keep the errors leading up to this one
+      err_fr_frozen=1;
+      //have the logger task save the snapshot
+      ctl_events_set_clear(&err_log_evt,ERR_LOG_EV_SNAPSHOT,0);
+    }
+  }
+  //restore interrupts
+  ctl_global_interrupts_set(en);
+}
+
+//set the lowest level kept by the flight recorder and the level that saves a snapshot
+void set_error_flight_recorder(unsigned char level,unsigned char trigger){
+  err_fr_level=level;
+  err_fr_trigger=trigger;
+  err_fr_set=1;
+  err_floor_update();
+}
+
+#ifdef SD_CARD_OUTPUT
+  //read a snapshot and check that it is valid
+  static int err_snap_read(short slot,unsigned char *buf){
+    ERR_SNAP *snap=(ERR_SNAP*)buf;
+    if(mmcReadBlock(ERR_SNAP_ADDR(slot),buf)!=MMC_SUCCESS){
+      return 0;
+    }
+    return snap->sig1==ERROR_BLOCK_SIGNATURE1 && snap->sig2==ERR_SNAP_SIGNATURE2 && snap->version==ERR_SNAP_VERSION &&
+           snap->count<=ERR_SNAP_NUM && snap->chk==err_crc16(ERR_CRC_INIT,buf,512-2);
+  }
+
+  //find the slot of the most recent snapshot, returns -1 if there are no snapshots
+  static short err_snap_newest(unsigned char *buf,unsigned short *number){
+    ERR_SNAP *snap=(ERR_SNAP*)buf;
+    short slot,newest=-1;
+    for(slot=0;slot<ERR_SNAP_SLOTS;slot++){
+      if(err_snap_read(slot,buf) && (newest<0 || (short)(snap->number-*number)>0)){
+        newest=slot;
+        *number=snap->number;
+      }
+    }
+    return newest;
+  }
+
+  //read a snapshot into buf, idx is zero for the most recent snapshot
+  //returns 1 if the snapshot is valid
+  static int err_snap_get(unsigned short idx,unsigned char *buf){
+    unsigned short number;
+    short newest;
+    int ok=0;
+    if(idx>=ERR_SNAP_SLOTS || mmcLock(CTL_TIMEOUT_DELAY,10)!=MMC_SUCCESS){
+      return 0;
+    }
+    newest=err_snap_newest(buf,&number);
+    if(newest>=0){
+      ok=err_snap_read((newest-(short)idx+ERR_SNAP_SLOTS)%ERR_SNAP_SLOTS,buf);
+    }
+    mmcUnlock();
+    return ok;
+  }
+#endif
+
+//save the flight recorder ring after a snapshot has been triggered
+static void err_fr_save(void){
+  unsigned short n,start,i;
+  #ifdef SD_CARD_OUTPUT
+    unsigned char *buf;
+    ERR_SNAP *snap;
+    short newest;
+    //snapshots can only be saved once the SD card has been setup
+    if(!running){
+      //recording start saves the snapshot, if recording could not start there is no card to save it to
+      if(!err_fr_hold){
+        err_fr_frozen=0;
+      }
+      return;
+    }
+    if(mmcLock(CTL_TIMEOUT_DELAY,2048)!=MMC_SUCCESS){
+      ERR_LAT_COUNT(timeouts);
+      //unfreeze ring, the snapshot is lost
+      err_fr_frozen=0;
+      return;
+    }
+    buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+    if(buf){
+      snap=(ERR_SNAP*)buf;
+      //find where the next snapshot goes
+      if(err_snap_next<0){
+        newest=err_snap_newest(buf,&err_snap_number);
+        if(newest<0){
+          err_snap_next=0;
+          err_snap_number=0;
+        }else{
+          err_snap_next=(newest+1)%ERR_SNAP_SLOTS;
+          err_snap_number++;
+        }
+      }
+      //errors to save
+      n=(err_fr_head<ERR_FR_SIZE)?err_fr_head:ERR_FR_SIZE;
+      if(n>ERR_SNAP_NUM){
+        n=ERR_SNAP_NUM;
+      }
+      start=err_fr_head-n;
+      //fill in snapshot
+      memset(buf,0,512);
+      snap->sig1=ERROR_BLOCK_SIGNATURE1;
+      snap->sig2=ERR_SNAP_SIGNATURE2;
+      snap->number=err_snap_number;
+      snap->version=ERR_SNAP_VERSION;
+      snap->count=n;
+      snap->time=err_fr_buf[(err_fr_head-1)&(ERR_FR_SIZE-1)].time;
+      for(i=0;i<n;i++){
+        memcpy(snap->data+i*sizeof(ERROR_DAT),&err_fr_buf[(start+i)&(ERR_FR_SIZE-1)],sizeof(ERROR_DAT));
+      }
+      snap->chk=err_crc16(ERR_CRC_INIT,buf,512-2);
+      //write snapshot
+      if(mmcWriteBlock(ERR_SNAP_ADDR(err_snap_next),buf)==MMC_SUCCESS){
+        err_snap_next=(err_snap_next+1)%ERR_SNAP_SLOTS;
+        err_snap_number++;
+      }else{
+        ERR_LAT_COUNT(sd_fail);
+      }
+      BUS_free_buffer();
+    }
+    mmcUnlock();
+  #else
+    //no SD card, print the snapshot
+    n=(err_fr_head<ERR_FR_SIZE)?err_fr_head:ERR_FR_SIZE;
+    start=err_fr_head-n;
+    printf("Flight recorder : %u errors before trigger\r\n",n);
+    for(i=0;i<n;i++){
+      print_error(err_fr_buf[(start+i)&(ERR_FR_SIZE-1)].level,err_fr_buf[(start+i)&(ERR_FR_SIZE-1)].source,
+                  err_fr_buf[(start+i)&(ERR_FR_SIZE-1)].err,err_fr_buf[(start+i)&(ERR_FR_SIZE-1)].argument,err_fr_buf[(start+i)&(ERR_FR_SIZE-1)].time);
+    }
+  #endif
+  //start recording again
+  err_fr_frozen=0;
+}
+
+//print a list of saved snapshots, most recent first
+void error_snapshot_list(void){
+  #ifdef SD_CARD_OUTPUT
+    unsigned char *buf;
+    ERR_SNAP *snap;
+    ERROR_DAT dat;
+    unsigned short idx,number;
+    short newest;
+    int found=0;
+    char str[150];
+    //lock the card before taking the bus buffer
+    if(mmcLock(CTL_TIMEOUT_DELAY,10)!=MMC_SUCCESS){
+      printf("Error : failed to lock SD card\r\n");
+      return;
+    }
+    buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+    if(!buf){
+      mmcUnlock();
+      printf("Error : failed to get buffer\r\n");
+      return;
+    }
+    snap=(ERR_SNAP*)buf;
+    //find the most recent snapshot once and walk back from it
+    newest=err_snap_newest(buf,&number);
+    for(idx=0;newest>=0 && idx<ERR_SNAP_SLOTS && err_snap_read((newest-(short)idx+ERR_SNAP_SLOTS)%ERR_SNAP_SLOTS,buf);idx++){
+      if(snap->count>0){
+        //the last error is the one that triggered the snapshot
+        memcpy(&dat,snap->data+(snap->count-1)*sizeof(ERROR_DAT),sizeof(ERROR_DAT));
+        printf("%2u : #%-5u %10lu : %3u errors : %s\r\n",idx,snap->number,(unsigned long)snap->time,snap->count,err_do_decode(str,dat.source,dat.err,dat.argument,0));
+        found=1;
+      }
+    }
+    BUS_free_buffer();
+    mmcUnlock();
+    if(!found){
+      printf("No snapshots\r\n");
+    }
+  #else
+    printf("Snapshots are only saved to the SD card\r\n");
+  #endif
+}
+
+//read a snapshot into a buffer using the same format as error_log_mem_replay, idx is zero for the most recent snapshot
+//returns the number of errors read or -1 if the snapshot could not be read
+int error_snapshot_mem(unsigned short idx,unsigned char *dest,unsigned short size,unsigned char *buf){
+  unsigned short *num=(unsigned short*)dest;
+  #ifdef SD_CARD_OUTPUT
+    ERR_SNAP *snap=(ERR_SNAP*)buf;
+    unsigned short n;
+  #endif
+  *num=0;
+  #ifdef SD_CARD_OUTPUT
+    if(!err_snap_get(idx,buf)){
+      return -1;
+    }
+    //copy as many errors as will fit
+    n=(size-sizeof(*num))/sizeof(ERROR_DAT);
+    if(n>snap->count){
+      n=snap->count;
+    }
+    memcpy(dest+sizeof(*num),snap->data,n*sizeof(ERROR_DAT));
+    *num=n;
+    return n;
+  #else
+    return -1;
+  #endif
+}
+
+//print the errors in a snapshot, idx is zero for the most recent snapshot
+void error_snapshot_dump(unsigned short idx){
+  #ifdef SD_CARD_OUTPUT
+    unsigned char *buf;
+    ERR_SNAP *snap;
+    ERROR_DAT dat;
+    int i;
+    //lock the card before taking the bus buffer, err_snap_get takes the lock again
+    if(mmcLock(CTL_TIMEOUT_DELAY,10)!=MMC_SUCCESS){
+      printf("Error : failed to lock SD card\r\n");
+      return;
+    }
+    buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+    if(!buf){
+      mmcUnlock();
+      printf("Error : failed to get buffer\r\n");
+      return;
+    }
+    snap=(ERR_SNAP*)buf;
+    if(err_snap_get(idx,buf)){
+      printf("Snapshot #%u : %u errors\r\n",snap->number,snap->count);
+      for(i=0;i<snap->count;i++){
+        memcpy(&dat,snap->data+i*sizeof(ERROR_DAT),sizeof(ERROR_DAT));
+        print_error(dat.level,dat.source,dat.err,dat.argument,dat.time);
+      }
+    }else{
+      printf("Error : snapshot %u not found\r\n",idx);
+    }
+    BUS_free_buffer();
+    mmcUnlock();
+  #else
+    printf("Snapshots are only saved to the SD card\r\n");
+  #endif
+}
+
+//logger task, moves errors from the report queue into storage
+static void error_log_func(void *p){
+  ERR_REC rec;
+  CTL_EVENT_SET_t e;
+  int pending=0;
+  for(;;){
+    //wait for errors to be reported, wake up periodically while repeats are being counted
+    e=ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&err_log_evt,ERR_LOG_EV_QUEUE|ERR_LOG_EV_SNAPSHOT,pending?CTL_TIMEOUT_DELAY:CTL_TIMEOUT_NONE,ERR_REPEAT_CHECK);
+    //record all queued errors
+    while(err_queue_get(&err_queue,&rec.dat)){
+      //check for repeated errors
+      if(!err_repeat_check(&rec.dat)){
+        rec.repeat=0;
+        record_rec(&rec);
+      }
+      err_log_done=err_queue.tail;
+    }
+    //wake up tasks waiting in report_error_sync
+    ctl_events_set_clear(&err_log_evt,ERR_LOG_EV_DONE,0);
+    //record repeats that are finished
+    pending=err_repeat_expire();
+    //save flight recorder snapshot after the errors that triggered it are recorded
+    if(e&ERR_LOG_EV_SNAPSHOT){
+      err_fr_save();
+    }
+  }
+}
+
+//sink task, hands errors from the sink queue to the sink function
+static void err_sink_func(void *p){
+  ERR_SINK *sink=p;
+  ERROR_DAT dat;
+  for(;;){
+    //wait for errors to be reported or for the sink timeout
+    ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&sink->evt,ERR_SINK_EV_QUEUE,sink->timeout?CTL_TIMEOUT_DELAY:CTL_TIMEOUT_NONE,sink->timeout);
+    //give all queued errors to the sink
+    while(err_queue_get(&sink->queue,&dat)){
+      sink->func(sink,&dat);
+    }
+    //tell the sink that the queue is empty
+    sink->func(sink,NULL);
+  }
+}
+
+//add an output sink, errors reported at or above level are given to func from a task that uses stack
+int error_sink_add(ERR_SINK *sink,const char *name,unsigned char level,ERR_SINK_FUNC func,void *arg,ERROR_DAT *buf,unsigned short size,unsigned char pri,unsigned *stack,unsigned stack_size){
+  int en;
+  //queue size must be a power of two
+  if(size==0 || (size&(size-1))){
+    return ERR_INVALID_RANGE;
+  }
+  sink->level=level;
+  sink->func=func;
+  sink->arg=arg;
+  sink->timeout=0;
+  sink->reported=0;
+  ctl_events_init(&sink->evt,0);
+  err_queue_init(&sink->queue,buf,size,&sink->evt,ERR_SINK_EV_QUEUE);
+  //start sink task before errors are queued for it
+  ctl_task_run(&sink->task,pri,err_sink_func,sink,name,stack_size-2,stack+1,0);
+  //add to the list, disable interrupts so reporters see a complete list
+  en=ctl_global_interrupts_set(0);
+  sink->next=err_sinks;
+  err_sinks=sink;
+  ctl_global_interrupts_set(en);
+  return RET_SUCCESS;
+}
+
+//set the lowest level given to a sink, returns the old level
+unsigned char error_sink_level(ERR_SINK *sink,unsigned char level){
+  unsigned char tmp=sink->level;
+  sink->level=level;
+  return tmp;
+}
+
+//set the time in ms that a sink waits for errors before its function is called with NULL, zero waits for errors
+CTL_TIME_t error_sink_timeout(ERR_SINK *sink,CTL_TIME_t timeout){
+  CTL_TIME_t tmp=sink->timeout;
+  sink->timeout=timeout;
+  //wake the sink task so the new timeout is used
+  ctl_events_set_clear(&sink->evt,ERR_SINK_EV_QUEUE,0);
+  return tmp;
+}
+
+//get the number of errors dropped by a sink since the last call
+unsigned long error_sink_dropped(ERR_SINK *sink){
+  unsigned long dropped=err_queue_dropped(&sink->queue),ret;
+  ret=dropped-sink->reported;
+  sink->reported=dropped;
+  return ret;
+}
+
+//console sink function, decodes and prints errors
+void error_sink_print(ERR_SINK *sink,const ERROR_DAT *err){
+  unsigned long dropped;
+  if(err){
+    print_error(err->level,err->source,err->err,err->argument,err->time);
+  }else{
+    //check if messages were dropped since the last check
+    dropped=error_sink_dropped(sink);
+    if(dropped){
+      printf("%lu messages dropped\r\n",dropped);
+    }
+  }
+}
+
+//get error statistics
+void error_stats(ERR_STATS *dest){
+  //lock saved errors mutex so the statistics are consistent
+  ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+  *dest=err_stats;
+  ctl_mutex_unlock(&saved_err_mutex);
+  //get errors dropped by the queues
+  dest->dropped=error_queue_overflows();
+}
+
+//clear error statistics, dropped errors are counted by the queues and are not cleared
+void error_stats_clear(void){
+  int en;
+  ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+  en=ctl_global_interrupts_set(0);
+  memset(&err_stats,0,sizeof(err_stats));
+  ctl_global_interrupts_set(en);
+  ctl_mutex_unlock(&saved_err_mutex);
+}
+
+//print error statistics
+void print_error_stats(void){
+  static const unsigned char class_lev[ERR_STAT_LEVELS]={ERR_LEV_DEBUG,ERR_LEV_INFO,ERR_LEV_WARNING,ERR_LEV_ERROR,ERR_LEV_CRITICAL};
+  ERR_STATS stats;
+  ERR_STAT_SRC tmp;
+  int i,j;
+  error_stats(&stats);
+  for(i=0;i<ERR_STAT_LEVELS;i++){
+    printf("%-14s : %lu\r\n",ERR_lev_str(class_lev[i]),stats.levels[i]);
+  }
+  printf("Dropped        : %lu\r\nFiltered       : %lu\r\nBad blocks     : %lu\r\n",stats.dropped,stats.filtered,stats.bad_blocks);
+  printf("First          : %lu\r\nLast           : %lu\r\n",(unsigned long)stats.first,(unsigned long)stats.last);
+  //sort sources by count
+  for(i=1;i<ERR_STAT_TOP;i++){
+    for(j=i;j>0 && stats.top[j].count>stats.top[j-1].count;j--){
+      tmp=stats.top[j];
+      stats.top[j]=stats.top[j-1];
+      stats.top[j-1]=tmp;
+    }
+  }
+  printf("Top sources :\r\n");
+  for(i=0;i<ERR_STAT_TOP && stats.top[i].count;i++){
+    printf("%5u : %5u (+0/-%u)\r\n",stats.top[i].source,stats.top[i].count,stats.top[i].over);
+  }
+}
+
+//get latency statistics, returns zero if latency statistics are not enabled
+int error_latency_stats(ERR_LAT_STATS *dest){
+  #ifdef ERR_LATENCY_STATS
+    int en;
+    //disable interrupts so the statistics are consistent
+    en=ctl_global_interrupts_set(0);
+    *dest=err_lat;
+    ctl_global_interrupts_set(en);
+    return 1;
+  #else
+    memset(dest,0,sizeof(*dest));
+    return 0;
+  #endif
+}
+
+//clear latency statistics
+void error_latency_clear(void){
+  #ifdef ERR_LATENCY_STATS
+    int en;
+    en=ctl_global_interrupts_set(0);
+    memset(&err_lat,0,sizeof(err_lat));
+    ctl_global_interrupts_set(en);
+  #endif
+}
+
+//print latency statistics
+void print_error_latency(void){
+  static const char *const names[ERR_LAT_PHASES]={"report","mutex wait","SD write","print"};
+  ERR_LAT_STATS stats;
+  const ERR_LAT *lat;
+  int i,j;
+  if(!error_latency_stats(&stats)){
+    printf("Error latency statistics not enabled\r\n");
+    return;
+  }
+  printf("phase      :      count    min    max   mean : histogram by significant bits\r\n");
+  for(i=0;i<ERR_LAT_PHASES;i++){
+    lat=&stats.phase[i];
+    printf("%-10s : %10lu %6u %6u %6lu :",names[i],lat->count,lat->min,lat->max,lat->count?lat->total/lat->count:0);
+    for(j=0;j<ERR_LAT_BINS;j++){
+      printf(" %u",lat->hist[j]);
     }
+    printf("\r\n");
   }
-  //source unknown, return string with error numbers
-  sprintf(buf,"Unknown Source : source = %u, error = %u, argument = %u",source,err,argument);
-  //return buffer
-  return buf;
+  printf("Lock timeouts : %lu\r\nSD failures   : %lu\r\n",stats.timeouts,stats.sd_fail);
 }
 
-//print an error
-void print_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time){
-  char buf[150];
-  const char *lev_str;
-  //check error level and use appropriate string
-  lev_str=ERR_lev_str(level);
-  //print message
-  printf("%10lu:%-14s (%3i) : %s\r\n",time,lev_str,level,err_do_decode(buf,source,err,argument,0));
+//get the number of errors that were dropped because the report queue was full
+unsigned long error_queue_overflows(void){
+  return err_queue_dropped(&err_queue);
 }
 
 //report error function : record an error if it's level is greater then the log level
+//this can be called from tasks or interrupts
 void report_error(unsigned char level,unsigned short source,int err, unsigned short argument){
+  int en;
+  //check level for the source
+  if(level>=err_src_threshold(source)){
+    _report_error(level,source,err,argument);
+  }else{
+    //count filtered errors, disable interrupts so counts from interrupts are not lost
+    en=ctl_global_interrupts_set(0);
+    err_stats.filtered++;
+    ctl_global_interrupts_set(en);
+    //keep the error in the flight recorder only
+    if(level>=err_fr_level){
+      err_fr_put(level,source,err,argument,get_ticker_time());
+    }
+  }
+}
+
+//report an error and wait for the logger task to record it, only waits when called from a task
+void report_error_sync(unsigned char level,unsigned short source,int err, unsigned short argument){
+  unsigned short head;
+  report_error(level,source,err,argument);
+  //interrupts can't wait and errors reported before the logger task starts are recorded by report_error
+  if(ctl_interrupt_count!=0 || !err_log_running){
+    return;
+  }
+  //wait for everything queued so far including this error
+  head=err_queue.head;
+  for(;;){
+    //clear the event before checking so that a wake up after the check is not lost
+    ctl_events_set_clear(&err_log_evt,0,ERR_LOG_EV_DONE);
+    if((short)(err_log_done-head)>=0){
+      break;
+    }
+    //another waiter can clear the event, so wake up now and then to check again
+    ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS,&err_log_evt,ERR_LOG_EV_DONE,CTL_TIMEOUT_DELAY,ERR_SYNC_CHECK);
+  }
+}
+
+//report an error without checking the level
+void _report_error(unsigned char level,unsigned short source,int err, unsigned short argument){
+  ERR_SINK *sink;
   ticker time;
-  //check log level
-  if(level>=log_level){
-    time=get_ticker_time();
-    //if error level is above threshold then print and record the error
+  #ifdef ERR_LATENCY_STATS
+    unsigned short start=ERR_LAT_TIMER();
+  #endif
+  time=get_ticker_time();
+  //add to flight recorder
+  err_fr_put(level,source,err,argument,time);
+  //check if errors can be recorded directly
+  if(!err_log_running && ctl_interrupt_count==0){
+    //logger task not running yet, record the error in this task
     record_error(level,source,err,argument,time);
     #ifdef PRINTF_OUTPUT
       print_error(level,source,err,argument,time);
     #endif
+  }else{
+    //queue error for the logger task
+    err_queue_put(&err_queue,level,source,err,argument,time);
   }
+  //queue error for each output sink that wants it, sink tasks do the slow work
+  for(sink=err_sinks;sink;sink=sink->next){
+    if(level>=sink->level){
+      err_queue_put(&sink->queue,level,source,err,argument,time);
+    }
+  }
+  #ifdef ERR_LATENCY_STATS
+    err_lat_add(ERR_LAT_REPORT,ERR_LAT_TIMER()-start);
+  #endif
 }
 
 //clear all errors saved on the SD card
 int clear_saved_errors(void){
-  int ret;
+  int ret=RET_SUCCESS;
+  #ifdef SD_CARD_OUTPUT
+    unsigned char *buf;
+    //wait for full blocks to finish writing so that no more blocks from the old epoch are written
+    ctl_mutex_lock(&err_write_mutex,CTL_TIMEOUT_NONE,0);
+    //save the new epoch so the log stays cleared after a reset
+    //this is done without locking the saved errors mutex so that errors can be recorded during the write
+    ret=mmcLock(CTL_TIMEOUT_DELAY,2048);
+    if(ret==MMC_SUCCESS){
+      buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+      if(buf){
+        ret=err_super_write(buf,err_epoch+1);
+        BUS_free_buffer();
+      }else{
+        ret=ERR_BUSY;
+      }
+      mmcUnlock();
+    }else{
+      ERR_LAT_COUNT(timeouts);
+    }
+  #endif
   //lock saved errors mutex
   ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
   #ifdef SD_CARD_OUTPUT
-     ret=mmcErase(ERR_ADDR_START,ERR_ADDR_END);
-  #else
-    ret=0;
+     //blocks on the SD card are cleared by moving to the next epoch, they are written over as the log wraps around
+     err_epoch++;
+     #ifdef ERR_SD_MULTI_BLOCK
+       //blocks that were read ahead are from the old epoch
+       err_sd_gen++;
+     #endif
   #endif
     //clear errors saved in RAM
     next_idx=0;
+    #ifndef SD_CARD_OUTPUT
+      err_ram_total=0;
+    #endif
     memset(err_dest,0,sizeof(ERROR_BLOCK));
     #ifdef SD_CARD_OUTPUT
-      //reset current block
-      current_block=0;
+      //start the log at the beginning of the region
+      current_block=err_addr_start;
       //set error signatures
-      errors.sig1=ERROR_BLOCK_SIGNATURE1;
-      errors.sig2=ERROR_BLOCK_SIGNATURE2;
-      errors.number=0;
+      err_dest->sig1=ERROR_BLOCK_SIGNATURE1;
+      err_dest->sig2=ERROR_BLOCK_SIGNATURE2;
+      err_dest->version=ERROR_BLOCK_VERSION;
+      err_dest->number=0;
+      err_block_reset(err_dest);
+      //full blocks are no longer needed
+      err_pending=0;
+      //block is now clean
+      err_dirty=0;
+      err_flush_armed=0;
+      memset(err_unwritten,0,sizeof(err_unwritten));
+      //forget block summaries and add the current block
+      err_index_clear();
+      err_index_set(err_dest,current_block);
     #endif
+    err_keep_update();
   ctl_mutex_unlock(&saved_err_mutex);
+  #ifdef SD_CARD_OUTPUT
+    ctl_mutex_unlock(&err_write_mutex);
+  #endif
   return ret;
 }
   
-void error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char level,unsigned char *buf){
+//copy a decoded error into a replay buffer as error slots
+//if there is not enough room size is set to zero so that the replay stops
+static void err_replay_copy(ERROR_DAT **dest,unsigned short *size,unsigned short *num,const ERR_REC *rec){
+  ERROR_DAT slots[2];
+  int n;
+  //convert to error slots
+  n=err_rec_to_dat(rec,slots);
+  //check for room
+  if(*size<n*sizeof(ERROR_DAT)){
+    *size=0;
+    return;
+  }
+  //copy error
+  memcpy(*dest,slots,n*sizeof(ERROR_DAT));
+  *dest+=n;
+  //increment count
+  *num+=n;
+  *size-=n*sizeof(ERROR_DAT);
+}
+
+int error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char level,unsigned char *buf){
+  ERR_FILTER filter;
+  error_filter_init(&filter,level);
+  return error_log_mem_replay_filter(dest,size,&filter,buf);
+}
+
+//read errors that pass filter into a buffer starting with the most recent ones
+int error_log_mem_replay_filter(unsigned char *dest,unsigned short size,const ERR_FILTER *filter,unsigned char *buf){
   //place to write number of errors to
   unsigned short *num=(unsigned short*)dest;
-  int i,skip;
+  unsigned short pos;
+  ERR_REC rec;
   #ifdef SD_CARD_OUTPUT
-    SD_block_addr start=current_block,addr=start;
+    SD_block_addr start,addr;
     ERROR_BLOCK *blk;
-    unsigned long number=errors.number;
-    int resp,last;
+    const ERR_SUMMARY *sum;
+    unsigned short src_mask=err_src_mask(filter->src_min,filter->src_max);
+    unsigned long number;
+    int resp,last=0;
   #endif
   ERROR_DAT *_dest=(ERROR_DAT*)(dest+2);
   //set num to zero
@@ -387,72 +2930,77 @@ void error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char
   //subtract the size of num from size
   size-=sizeof(*num);
   #ifdef SD_CARD_OUTPUT
+    //make sure that the SD card has the most recent errors
+    error_flush();
+    start=addr=current_block;
+    number=err_dest->number;
+    //a new block is not written until it has errors, start at the previous block
+    if(err_dest->used==0 && number!=0){
+      addr=err_addr_prev(addr);
+      number--;
+    }
     resp=mmcLock(CTL_TIMEOUT_DELAY,10);
     //check if card was locked
     if(resp==MMC_SUCCESS){
         for(;;){
-          //read block
-          resp=mmcReadBlock(addr,buf);
-          //check for error
-          if(resp==MMC_SUCCESS){
-            //check for valid error block
-            blk=(ERROR_BLOCK*)buf;
-            //check signature values
-            if(blk->sig1==ERROR_BLOCK_SIGNATURE1 && blk->sig2==ERROR_BLOCK_SIGNATURE2){
-              //check CRC
-              if(blk->chk==crc16((unsigned char*)blk,sizeof(ERROR_BLOCK)-sizeof(blk->chk))){
-                if(number!=blk->number){
-                  //update number
-                  number=blk->number;
-                }
-                //loop through the block printing the most recent errors first
-                for(i=NUM_ERRORS-1,skip=0;i>=0;i--){
-                  //check if error is valid
-                  if(blk->saved_errors[i].valid==SAVED_ERROR_MAGIC){
-                    //check if error slots have been skipped
-                    if(skip>0){
-                      //TODO: add gap error?
-                      //reset skip count
-                      skip=0;
-                    }
-                    //check error level
-                    if(blk->saved_errors[i].level>=level){
+          //check the summary to see if the block needs to be read
+          sum=err_index_get(number,addr);
+          if(!sum || err_sum_match(sum,filter,src_mask)){
+            //read block
+            resp=err_read_back(addr,number,filter,src_mask,buf);
+            //check for error
+            if(resp==MMC_SUCCESS){
+              //check for valid error block
+              blk=(ERROR_BLOCK*)buf;
+              //check header values
+              if(err_block_header_ok(blk)){
+                //check CRC
+                if(err_block_crc_ok(blk)){
+                  if(number!=blk->number){
+                    //update number
+                    number=blk->number;
+                  }
+                  //save summary so the block can be skipped next time
+                  err_index_fill(blk,addr);
+                  //loop through the block copying the most recent errors first
+                  for(pos=blk->used;pos>0;){
+                    //find previous error
+                    pos=err_rec_prev(blk->data,pos);
+                    //decode error
+                    err_rec_decode(blk->data,pos,blk->base,&rec);
+                    //check error against filter
+                    if(err_filter_rec(filter,&rec)){
                         //copy error
-                        memcpy(_dest++,&blk->saved_errors[i],sizeof(ERROR_DAT));
-                        //increment count
-                        (*num)++;
-                        size-=sizeof(ERROR_DAT);
+                        err_replay_copy(&_dest,&size,num,&rec);
                         //check if there is room for more errors
                         if(size<sizeof(ERROR_DAT)){
                             //done!
                             break;
                         }
                     }
-                  }else{
-                    //no valid error, skip
-                    skip++;
                   }
-                }
-                //check if dest is full
-                if(size<sizeof(ERROR_DAT)){
-                    break;
+                  //check if dest is full
+                  if(size<sizeof(ERROR_DAT)){
+                      break;
+                  }
+                }else{
+                    //block CRC is not valid, skip the block
+                    err_bad_block();
                 }
               }else{
-                  //block CRC is not valid TODO: do something
+                  //check if this block is expected to be the last
+                  if(last){
+                    //exit loop
+                    break;
+                  }
+                  //block header is not valid, skip the block
+                  err_bad_block();
               }
             }else{
-                //check if this block is expected to be the last
-                if(last){
-                  //exit loop
-                  break;
-                }
-                //TODO: block header is not valid
+               //error reading from SD card, it is returned
+               //exit loop to prevent further errors
+               break; 
             }
-          }else{
-             //error reading from SD card
-             //TODO: return error code?
-             //exit loop to prevent further errors
-             break; 
           }
           //check if this should be the last block
           if(number==0){
@@ -461,14 +3009,8 @@ void error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char
           }
           //next block should have a lower number decrement
           number--;
-          //check if address is at the beginning
-          if(addr==ERR_ADDR_START){
-            //set address to the end
-            addr=ERR_ADDR_END;
-          }else{
-            //decrement address
-            addr--;
-          }
+          //previous address with wraparound
+          addr=err_addr_prev(addr);
           //check if there are more errors to display
           if(addr==start){
             //replay complete, exit
@@ -478,44 +3020,54 @@ void error_log_mem_replay(unsigned char *dest,unsigned short size,unsigned char
       //unlock card
       mmcUnlock();
     }else{
-      //TODO: give error for SD card fail?
+      //SD card could not be locked, copy the errors in RAM and return the error
   #endif
-      if(next_idx!=0)
-            //print errors from buffer printing the most recent errors first
-            for(i=next_idx-1,skip=0;i>=0;i--){
-              //check if error is valid
-              if(errors.saved_errors[i].valid==SAVED_ERROR_MAGIC){
-                //check error level
-                if(errors.saved_errors[i].level>=level){
-                    //copy error
-                    memcpy(_dest++,&errors.saved_errors[i],sizeof(ERROR_DAT));
-                    //increment count
-                    (*num)++;
-                    size-=sizeof(ERROR_DAT);
-                    //check if there is room for more errors
-                    if(size<sizeof(ERROR_DAT)){
-                        //done!
-                        break;
-                    }
-                }
-              }
-            }
-
+      //copy errors from RAM, most recent errors first
+      for(pos=err_ram_first();size>=sizeof(ERROR_DAT) && err_ram_prev(&pos,&rec);){
+        //check error against filter
+        if(err_filter_rec(filter,&rec)){
+            //copy error
+            err_replay_copy(&_dest,&size,num,&rec);
+        }
+      }
   #ifdef SD_CARD_OUTPUT
       }
+      return resp;
+  #else
+      return RET_SUCCESS;
   #endif
 }      
 
 //print errors in the log starting with the most recent ones
 //print only errors with a level greater than level up to a maximum of num errors 
 void error_log_replay(unsigned short num,unsigned char level){
+  ERR_FILTER filter;
+  error_filter_init(&filter,level);
+  error_log_replay_filter(num,&filter);
+}
+
+//print errors in the log that pass filter starting with the most recent ones up to a maximum of num errors
+void error_log_replay_filter(unsigned short num,const ERR_FILTER *filter){
   unsigned short ecount=0;
   #ifdef SD_CARD_OUTPUT
-    SD_block_addr start=current_block,addr=start;
+    SD_block_addr start,addr;
     ERROR_BLOCK *blk;
-    unsigned long number=errors.number;
+    const ERR_SUMMARY *sum;
+    unsigned short src_mask=err_src_mask(filter->src_min,filter->src_max);
+    unsigned long number;
     unsigned char *buf;
-    int i,skip,resp,last;
+    unsigned short pos;
+    ERR_REC rec;
+    int resp,last=0;
+    //make sure that the SD card has the most recent errors
+    error_flush();
+    start=addr=current_block;
+    number=err_dest->number;
+    //a new block is not written until it has errors, start at the previous block
+    if(err_dest->used==0 && number!=0){
+      addr=err_addr_prev(addr);
+      number--;
+    }
     resp=mmcLock(CTL_TIMEOUT_DELAY,10);
     //check if card was locked
     if(resp==MMC_SUCCESS){
@@ -524,40 +3076,39 @@ void error_log_replay(unsigned short num,unsigned char level){
       //check if buffer acquired
       if(buf){
         for(;;){
-          //read block
-          resp=mmcReadBlock(addr,buf);
-          //check for error
-          if(resp==MMC_SUCCESS){
-            //check for valid error block
-            blk=(ERROR_BLOCK*)buf;
-            //check signature values
-            if(blk->sig1==ERROR_BLOCK_SIGNATURE1 && blk->sig2==ERROR_BLOCK_SIGNATURE2){
-              //check CRC
-              if(blk->chk==crc16((unsigned char*)blk,sizeof(ERROR_BLOCK)-sizeof(blk->chk))){
-                if(number!=blk->number){
-                  //print message
-                  printf("Missing block(s) expected #%u got #%u\r\n",number,blk->number);
-                  //update number
-                  number=blk->number;
-                }/*else{
-                  printf("Block #%u\r\n",blk->number);
-                }*/
-                //loop through the block printing the most recent errors first
-                for(i=NUM_ERRORS-1,skip=0;i>=0;i--){
-                  //check if error is valid
-                  if(blk->saved_errors[i].valid==SAVED_ERROR_MAGIC){
-                    //check if error slots have been skipped
-                    if(skip>0){
-                      //print the number of skipped error slots
-                      //printf("Skipping %i empty error slots\r\n",skip);
-                      printf("\r\n");
-                      //reset skip count
-                      skip=0;
-                    }
-                    //check error level
-                    if(blk->saved_errors[i].level>=level){
-                        //print error from error slot
-                        print_error(blk->saved_errors[i].level,blk->saved_errors[i].source,blk->saved_errors[i].err,blk->saved_errors[i].argument,blk->saved_errors[i].time);
+          //check the summary to see if the block needs to be read
+          sum=err_index_get(number,addr);
+          if(!sum || err_sum_match(sum,filter,src_mask)){
+            //read block
+            resp=err_read_back(addr,number,filter,src_mask,buf);
+            //check for error
+            if(resp==MMC_SUCCESS){
+              //check for valid error block
+              blk=(ERROR_BLOCK*)buf;
+              //check header values
+              if(err_block_header_ok(blk)){
+                //check CRC
+                if(err_block_crc_ok(blk)){
+                  if(number!=blk->number){
+                    //print message
+                    printf("Missing block(s) expected #%lu got #%u\r\n",number,blk->number);
+                    //update number
+                    number=blk->number;
+                  }/*else{
+                    printf("Block #%u\r\n",blk->number);
+                  }*/
+                  //save summary so the block can be skipped next time
+                  err_index_fill(blk,addr);
+                  //loop through the block printing the most recent errors first
+                  for(pos=blk->used;pos>0;){
+                    //find previous error
+                    pos=err_rec_prev(blk->data,pos);
+                    //decode error
+                    err_rec_decode(blk->data,pos,blk->base,&rec);
+                    //check error against filter
+                    if(err_filter_rec(filter,&rec)){
+                        //print error
+                        print_rec(&rec,0);
                         //check if we are counting
                         if(num!=0){
                             //increment count
@@ -569,34 +3120,33 @@ void error_log_replay(unsigned short num,unsigned char level){
                             }
                         }
                     }
-                  }else{
-                    //no valid error, skip
-                    skip++;
                   }
-                }
-                //check if enough errors have been printed
-                if(num!=0 && ecount>=num){
-                    //done!
-                    break;
+                  //check if enough errors have been printed
+                  if(num!=0 && ecount>=num){
+                      //done!
+                      break;
+                  }
+                }else{
+                    //block CRC is not valid, print error
+                    printf("Error : invalid block CRC\r\n");
+                    err_bad_block();
                 }
               }else{
-                  //block CRC is not valid, print error
-                  printf("Error : invalid block CRC\r\n");
+                  //check if this block is expected to be the last
+                  if(last){
+                    //exit loop
+                    break;
+                  }
+                  //block header is not valid
+                  printf("Error : invalid block header\r\n");
+                  err_bad_block();
               }
             }else{
-                //check if this block is expected to be the last
-                if(last){
-                  //exit loop
-                  break;
-                }
-                //block header is not valid
-                printf("Error : invalid block header\r\n");
+               //error reading from SD card
+               printf("Error : failed to read from SD card : %s\r\n",SD_error_str(resp));
+               //exit loop to prevent further errors
+               break; 
             }
-          }else{
-             //error reading from SD card
-             printf("Error : failed to read from SD card : %s\r\n",SD_error_str(resp));
-             //exit loop to prevent further errors
-             break; 
           }
           //check if this should be the last block
           if(number==0){
@@ -605,14 +3155,8 @@ void error_log_replay(unsigned short num,unsigned char level){
           }
           //next block should have a lower number decrement
           number--;
-          //check if address is at the beginning
-          if(addr==ERR_ADDR_START){
-            //set address to the end
-            addr=ERR_ADDR_END;
-          }else{
-            //decrement address
-            addr--;
-          }
+          //previous address with wraparound
+          addr=err_addr_prev(addr);
           //check if there are more errors to display
           if(addr==start){
             //replay complete, exit
@@ -628,17 +3172,15 @@ void error_log_replay(unsigned short num,unsigned char level){
       mmcUnlock();
     }else{
       printf("Error : Failed to lock SD card : %s\r\nPrinting Errors from RAM\r\n\r\n",SD_error_str(resp));
-      if(next_idx==0){
+      if(err_dest->count==0){
          printf("No errors to display\r\n");
       }else{
             //print errors from buffer printing the most recent errors first
-            for(i=next_idx-1,skip=0;i>=0;i--){
-              //check if error is valid
-              if(errors.saved_errors[i].valid==SAVED_ERROR_MAGIC){
-                //check error level
-                if(errors.saved_errors[i].level>=level){
-                    //print error from error slot
-                    print_error(errors.saved_errors[i].level,errors.saved_errors[i].source,errors.saved_errors[i].err,errors.saved_errors[i].argument,errors.saved_errors[i].time);
+            for(pos=err_ram_first();err_ram_prev(&pos,&rec);){
+                //check error against filter
+                if(err_filter_rec(filter,&rec)){
+                    //print error
+                    print_rec(&rec,0);
                     //check if we are counting
                     if(num!=0){
                         //increment count
@@ -650,33 +3192,19 @@ void error_log_replay(unsigned short num,unsigned char level){
                         }
                     }
                 }
-              }
             }
       }
     }
   #else
     //print errors stored in error buffer stored in RAM
-    int idx,start;
-    //start at with the next index to print which gets decremented to start at the last error printed
-    start=next_idx;
-    //set index to start
-    idx=start;
-    do{
-      //decrement idx
-      idx--;
-      //wrap around
-      if(idx<0){
-        idx=NUM_ERRORS-1;
-      }
-      //check if error is valid
-      if(err_dest->saved_errors[idx].valid!=SAVED_ERROR_MAGIC){
-        //error not valid, exit
-        break;
-      }
-      //check error level
-      if(err_dest->saved_errors[idx].level>=level){
+    ERR_REC rec;
+    unsigned short pos;
+    //start with the most recent error
+    for(pos=err_ram_first();err_ram_prev(&pos,&rec);){
+      //check error against filter
+      if(err_filter_rec(filter,&rec)){
           //print error
-          print_error(err_dest->saved_errors[idx].level,err_dest->saved_errors[idx].source,err_dest->saved_errors[idx].err,err_dest->saved_errors[idx].argument,err_dest->saved_errors[idx].time);
+          print_rec(&rec,0);
           //check if we are counting
           if(num!=0){
               //increment count
@@ -688,37 +3216,623 @@ void error_log_replay(unsigned short num,unsigned char level){
               }
           }
       }
-    }while(idx!=start);
+    }
   #endif  
 }
 
+#ifdef SD_CARD_OUTPUT
+  //cursor position for the start of a block that has not been read yet
+  #define ERR_CURSOR_BLOCK_END  (0xFFFF)
+#endif
+
+//open a cursor at the most recent error
+void error_cursor_open(ERR_CURSOR *cur,const ERR_FILTER *filter){
+  if(filter){
+    cur->filter=*filter;
+  }else{
+    error_filter_init(&cur->filter,0);
+  }
+  //lock saved errors mutex so the position is consistent
+  ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+  #ifdef SD_CARD_OUTPUT
+    //start at the end of the current block
+    cur->addr=current_block;
+    cur->number=err_dest->number;
+    cur->pos=err_dest->used;
+    //stop after one trip around the error region
+    cur->last=cur->number-(ERR_REGION_SIZE-1);
+    //a new block is not written until it has errors, start at the previous block
+    if(err_dest->used==0){
+      cur->addr=err_addr_prev(cur->addr);
+      cur->number--;
+      cur->pos=ERR_CURSOR_BLOCK_END;
+    }
+  #else
+    //start at the most recent slot
+    cur->addr=err_ram_total;
+    cur->number=0;
+    cur->last=0;
+    cur->pos=0;
+  #endif
+  ctl_mutex_unlock(&saved_err_mutex);
+  cur->state=ERR_CURSOR_MORE;
+}
+
+//destination for errors read with a cursor
+typedef struct{
+  //where the next error goes
+  unsigned char *ptr;
+  //bytes left
+  unsigned short size;
+  //number of errors or error slots added
+  unsigned short num;
+  //errors are encoded relative to base instead of copied as error slots
+  unsigned char compact;
+  //base time of encoded errors, the time of the first error
+  ticker base;
+}ERR_OUT;
+
+//smallest space that an error can use
+static unsigned short err_out_min(const ERR_OUT *out){
+  return out->compact?ERR_REC_FIELDS:sizeof(ERROR_DAT);
+}
+
+//add an error to the destination, returns zero if it does not fit
+static int err_out_add(ERR_OUT *out,const ERR_REC *rec){
+  ERROR_DAT *dest;
+  unsigned char tmp[ERR_REC_MAX];
+  unsigned short len;
+  unsigned short size;
+  if(out->compact){
+    //the first error sets the base time
+    if(out->num==0){
+      out->base=rec->dat.time;
+    }
+    //encode in place if any error will fit
+    if(out->size>=ERR_REC_MAX){
+      len=err_rec_encode(out->ptr,rec,out->base);
+    }else{
+      len=err_rec_encode(tmp,rec,out->base);
+      if(len>out->size){
+        return 0;
+      }
+      memcpy(out->ptr,tmp,len);
+    }
+    out->ptr+=len;
+    out->size-=len;
+    out->num++;
+    return 1;
+  }else{
+    dest=(ERROR_DAT*)out->ptr;
+    size=out->size;
+    len=out->num;
+    err_replay_copy(&dest,&size,&len,rec);
+    //check if the error fit
+    if(len==out->num){
+      return 0;
+    }
+    out->ptr=(unsigned char*)dest;
+    out->size=size;
+    out->num=len;
+    return 1;
+  }
+}
+
+//read errors into out starting where the last read left off
+//errors in RAM are written to the SD card by the caller so that it can be done before taking other locks
+static int err_cursor_read(ERR_CURSOR *cur,ERR_OUT *out,unsigned char *buf){
+  ERR_REC rec;
+  #ifdef SD_CARD_OUTPUT
+    ERROR_BLOCK *blk=(ERROR_BLOCK*)buf;
+    const ERR_SUMMARY *sum;
+    unsigned short src_mask=err_src_mask(cur->filter.src_min,cur->filter.src_max);
+    unsigned short prev;
+  #else
+    unsigned short pos,prev;
+  #endif
+  #ifdef SD_CARD_OUTPUT
+    //check if the block has been written over since the last batch
+    if((unsigned short)(err_dest->number-cur->number)>ERR_REGION_SIZE-1){
+      return cur->state=ERR_CURSOR_WRAPPED;
+    }
+    if(mmcLock(CTL_TIMEOUT_DELAY,10)!=MMC_SUCCESS){
+      //try again later
+      return ERR_CURSOR_SD_ERROR;
+    }
+    while(out->size>=err_out_min(out)){
+      //check the summary to see if a new block needs to be read
+      sum=(cur->pos==ERR_CURSOR_BLOCK_END)?err_index_get(cur->number,cur->addr):NULL;
+      if(!sum || err_sum_match(sum,&cur->filter,src_mask)){
+        //read block
+        if(err_read_back(cur->addr,cur->number,&cur->filter,src_mask,buf)!=MMC_SUCCESS){
+          mmcUnlock();
+          //return errors that were read, the block is read again next time
+          return out->num?ERR_CURSOR_MORE:ERR_CURSOR_SD_ERROR;
+        }
+        //check for the start of the log
+        if(!err_block_header_ok(blk)){
+          cur->state=ERR_CURSOR_END;
+          break;
+        }
+        //check if the block has been written over
+        if(blk->number!=cur->number){
+          cur->state=ERR_CURSOR_WRAPPED;
+          break;
+        }
+        //blocks with bad CRCs are skipped
+        if(!err_block_crc_ok(blk)){
+          err_bad_block();
+        }else{
+          //save summary so the block can be skipped next time
+          err_index_fill(blk,cur->addr);
+          //start at the end of a new block
+          if(cur->pos==ERR_CURSOR_BLOCK_END){
+            cur->pos=blk->used;
+          }
+          //copy errors until dest is full
+          while(cur->pos>0){
+            prev=err_rec_prev(blk->data,cur->pos);
+            err_rec_decode(blk->data,prev,blk->base,&rec);
+            //check error against filter, if the error does not fit it is read in the next batch
+            if(err_filter_rec(&cur->filter,&rec) && !err_out_add(out,&rec)){
+              break;
+            }
+            cur->pos=prev;
+            //check if dest is full
+            if(out->size<err_out_min(out)){
+              break;
+            }
+          }
+          //check if there are errors left in the block
+          if(cur->pos>0){
+            break;
+          }
+        }
+      }
+      //check for the oldest block, block numbers wrap so the start of a log that has not filled the region is found by its header
+      if(cur->number==cur->last){
+        cur->state=ERR_CURSOR_END;
+        break;
+      }
+      //move to the previous block
+      cur->number--;
+      cur->addr=err_addr_prev(cur->addr);
+      cur->pos=ERR_CURSOR_BLOCK_END;
+    }
+    //done using card, unlock
+    mmcUnlock();
+  #else
+    //lock saved errors mutex so the ring does not change
+    ctl_mutex_lock(&saved_err_mutex,CTL_TIMEOUT_NONE,0);
+    if(cur->addr>err_ram_total || cur->addr+NUM_ERRORS<=err_ram_total){
+      //errors have been written over or cleared
+      cur->state=ERR_CURSOR_WRAPPED;
+    }else{
+      //get position in the ring
+      pos=cur->addr+NUM_ERRORS-err_ram_total;
+      while(out->size>=err_out_min(out)){
+        prev=pos;
+        //get next error
+        if(!err_ram_prev(&pos,&rec)){
+          cur->state=ERR_CURSOR_END;
+          break;
+        }
+        //check error against filter, if the error does not fit it is read in the next batch
+        if(err_filter_rec(&cur->filter,&rec) && !err_out_add(out,&rec)){
+          pos=prev;
+          break;
+        }
+      }
+      //check if all errors have been read
+      if(pos==0){
+        cur->state=ERR_CURSOR_END;
+      }
+      //save position
+      cur->addr=err_ram_total+pos-NUM_ERRORS;
+    }
+    ctl_mutex_unlock(&saved_err_mutex);
+  #endif
+  return cur->state;
+}
+
+//read the next batch of errors into dest starting where the last batch left off
+int error_cursor_next_batch(ERR_CURSOR *cur,unsigned char *dest,unsigned short size,unsigned char *buf){
+  ERR_OUT out;
+  int ret;
+  //set number of errors to zero
+  *(unsigned short*)dest=0;
+  //check if the cursor can be read
+  if(cur->state!=ERR_CURSOR_MORE){
+    return cur->state;
+  }
+  //make sure that any error will fit
+  if(size<sizeof(unsigned short)+2*sizeof(ERROR_DAT)){
+    return ERR_CURSOR_TOO_SMALL;
+  }
+  //errors go after the number of errors
+  out.ptr=dest+sizeof(unsigned short);
+  out.size=size-sizeof(unsigned short);
+  out.num=0;
+  out.compact=0;
+  //make sure that the SD card has the most recent errors
+  error_flush();
+  ret=err_cursor_read(cur,&out,buf);
+  *(unsigned short*)dest=out.num;
+  return ret;
+}
+
+//close a cursor
+void error_cursor_close(ERR_CURSOR *cur){
+  cur->state=ERR_CURSOR_CLOSED;
+}
+
+//size of the header of a SPI_ERROR_DAT stream packet: type, sender, count, sequence number and base time
+#define ERR_SPI_STREAM_HDR    (6+sizeof(ticker))
+
+//bytes of errors sent in each packet by error_export_spi
+#ifndef ERR_EXPORT_PKT_SIZE
+  #define ERR_EXPORT_PKT_SIZE   (256)
+#endif
+
+//number of times error_export_spi tries to read the SD card or get the bus buffer before giving up
+#ifndef ERR_EXPORT_TRIES
+  #define ERR_EXPORT_TRIES      (3)
+#endif
+
+//start an export of the error log starting at the most recent error
+void error_export_open(ERR_EXPORT *exp,const ERR_FILTER *filter,unsigned char src){
+  error_cursor_open(&exp->cur,filter);
+  exp->seq=0;
+  exp->src=src;
+}
+
+//build the next SPI_ERROR_DAT packet of an export without writing errors in RAM to the SD card first
+//errors are encoded from the SD card block straight into the packet
+static int err_export_build(ERR_EXPORT *exp,unsigned char *pkt,unsigned short size,unsigned char *buf){
+  ERR_OUT out;
+  unsigned short seq;
+  int ret;
+  //check if the last packet has been built
+  if(exp->cur.state!=ERR_CURSOR_MORE){
+    return 0;
+  }
+  //make sure that any error will fit
+  if(size<ERR_SPI_STREAM_HDR+ERR_REC_MAX){
+    return ERR_EXPORT_TOO_SMALL;
+  }
+  //errors go after the header
+  out.ptr=pkt+ERR_SPI_STREAM_HDR;
+  out.size=size-ERR_SPI_STREAM_HDR;
+  out.num=0;
+  out.compact=1;
+  out.base=0;
+  ret=err_cursor_read(&exp->cur,&out,buf);
+  //check if nothing could be read
+  if(ret==ERR_CURSOR_SD_ERROR){
+    return ERR_EXPORT_SD_ERROR;
+  }
+  //mark the last packet so the receiver knows that the export is complete
+  seq=exp->seq;
+  if(ret!=ERR_CURSOR_MORE){
+    seq|=ERR_SPI_LAST;
+  }
+  //fill in header
+  pkt[0]=SPI_ERROR_DAT;
+  pkt[1]=exp->src;
+  *(unsigned short*)(pkt+2)=out.num|ERR_SPI_COMPACT|ERR_SPI_STREAM;
+  *(unsigned short*)(pkt+4)=seq;
+  memcpy(pkt+6,&out.base,sizeof(out.base));
+  exp->seq++;
+  return out.ptr-pkt;
+}
+
+//build the next SPI_ERROR_DAT packet of an export
+int error_export_next(ERR_EXPORT *exp,unsigned char *pkt,unsigned short size,unsigned char *buf){
+  //make sure that the SD card has the most recent errors
+  error_flush();
+  return err_export_build(exp,pkt,size,buf);
+}
+
+//send errors to a bus address as a stream of SPI_ERROR_DAT packets
+//the bus buffer holds the SD card block that is being read followed by the packet that is being sent
+//the buffer is taken for each packet after errors in RAM are written and the SD card is locked to keep the lock order
+int error_export_spi(unsigned char addr,unsigned char src,const ERR_FILTER *filter){
+  ERR_EXPORT exp;
+  unsigned char *buf;
+  int len,resp=RET_SUCCESS,tries=0;
+  error_export_open(&exp,filter,src);
+  for(;;){
+    //make sure that the SD card has the most recent errors
+    error_flush();
+    #ifdef SD_CARD_OUTPUT
+      //lock the card before taking the bus buffer, reading blocks takes the lock again
+      if(mmcLock(CTL_TIMEOUT_DELAY,10)!=MMC_SUCCESS){
+        if(++tries>=ERR_EXPORT_TRIES){
+          resp=ERR_BUSY;
+          break;
+        }
+        continue;
+      }
+    #endif
+    buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,100);
+    len=buf?err_export_build(&exp,buf+512,ERR_SPI_STREAM_HDR+ERR_EXPORT_PKT_SIZE,buf):ERR_EXPORT_SD_ERROR;
+    #ifdef SD_CARD_OUTPUT
+      mmcUnlock();
+    #endif
+    if(len<=0){
+      if(buf){
+        BUS_free_buffer();
+      }
+      //check if the last packet has been sent
+      if(len==0){
+        break;
+      }
+      //the SD card or the bus buffer could not be used
+      if(++tries>=ERR_EXPORT_TRIES){
+        resp=ERR_BUSY;
+        break;
+      }
+      continue;
+    }
+    tries=0;
+    //send packet, anything received goes in the SD card block which is read again for the next packet
+    resp=BUS_SPI_txrx(addr,buf+512,buf,len);
+    BUS_free_buffer();
+    if(resp!=RET_SUCCESS){
+      break;
+    }
+  }
+  error_cursor_close(&exp.cur);
+  return resp;
+}
+
+//shortest and longest time in ms that the forwarder waits after the bus was busy
+#ifndef ERR_FWD_BACKOFF_MIN
+  #define ERR_FWD_BACKOFF_MIN   (16)
+#endif
+#ifndef ERR_FWD_BACKOFF_MAX
+  #define ERR_FWD_BACKOFF_MAX   (1024)
+#endif
+//time in ms that the forwarder waits for the bus buffer
+#ifndef ERR_FWD_BUS_TIMEOUT
+  #define ERR_FWD_BUS_TIMEOUT   (10)
+#endif
+
+//send the forwarder packet, returns zero if the bus was busy
+static int err_fwd_send(ERR_FWD *fwd){
+  unsigned char *buf;
+  int resp=ERR_BUSY;
+  //fill in header, the stream never ends so ERR_SPI_LAST is not used
+  fwd->pkt[0]=SPI_ERROR_DAT;
+  fwd->pkt[1]=fwd->src;
+  *(unsigned short*)(fwd->pkt+2)=fwd->num|ERR_SPI_COMPACT|ERR_SPI_STREAM|ERR_SPI_FORWARD;
+  *(unsigned short*)(fwd->pkt+4)=fwd->seq;
+  memcpy(fwd->pkt+6,&fwd->base,sizeof(fwd->base));
+  //anything received goes in the bus buffer
+  buf=BUS_get_buffer(CTL_TIMEOUT_DELAY,ERR_FWD_BUS_TIMEOUT);
+  if(buf){
+    resp=BUS_SPI_txrx(fwd->addr,fwd->pkt,buf,fwd->len);
+    BUS_free_buffer();
+  }
+  if(resp!=RET_SUCCESS){
+    //wait longer each time the bus is busy
+    fwd->busy++;
+    fwd->retry=ctl_get_current_time()+fwd->backoff;
+    if(fwd->backoff<ERR_FWD_BACKOFF_MAX){
+      fwd->backoff*=2;
+    }
+    return 0;
+  }
+  fwd->sent++;
+  fwd->backoff=ERR_FWD_BACKOFF_MIN;
+  //start a new packet
+  fwd->seq=(fwd->seq+1)&~ERR_SPI_LAST;
+  fwd->num=0;
+  return 1;
+}
+
+//drop the forwarder packet, the sequence number is skipped so the receiver knows that errors are missing
+static void err_fwd_drop(ERR_FWD *fwd){
+  fwd->lost+=fwd->num;
+  //the next packet gets a fresh start instead of giving up after one try at the longest backoff
+  fwd->backoff=ERR_FWD_BACKOFF_MIN;
+  fwd->seq=(fwd->seq+1)&~ERR_SPI_LAST;
+  fwd->num=0;
+}
+
+//forwarder sink function, adds errors to the packet and sends it when it is full or due
+static void err_fwd_func(ERR_SINK *sink,const ERROR_DAT *err){
+  ERR_FWD *fwd=sink->arg;
+  unsigned char tmp[ERR_REC_MAX];
+  unsigned short len;
+  CTL_TIME_t now=ctl_get_current_time(),due;
+  unsigned long dropped;
+  ERR_REC rec;
+  if(err){
+    err_dat_to_rec(err,NULL,&rec);
+    //check if the error fits in the packet
+    if(fwd->num){
+      len=err_rec_encode(tmp,&rec,fwd->base);
+      if(len<=ERR_FWD_PKT_SIZE-fwd->len){
+        memcpy(fwd->pkt+fwd->len,tmp,len);
+        fwd->len+=len;
+        fwd->num++;
+        return;
+      }
+      //packet is full, the bus backoff is waited out here so that new errors wait in the sink queue
+      if((long)(now-fwd->retry)<0){
+        ctl_timeout_wait(fwd->retry);
+      }
+      while(!err_fwd_send(fwd)){
+        //give up on the packet once the backoff is as long as it gets
+        if(fwd->backoff>=ERR_FWD_BACKOFF_MAX){
+          err_fwd_drop(fwd);
+          break;
+        }
+        ctl_timeout_wait(fwd->retry);
+      }
+      now=ctl_get_current_time();
+    }
+    //errors dropped by the sink queue are counted as lost and a sequence number is skipped so the receiver knows
+    dropped=error_sink_dropped(sink);
+    if(dropped){
+      fwd->lost+=dropped;
+      fwd->seq=(fwd->seq+1)&~ERR_SPI_LAST;
+    }
+    //start a new packet with this error
+    fwd->base=rec.dat.time;
+    fwd->first=now;
+    fwd->len=ERR_SPI_STREAM_HDR+err_rec_encode(fwd->pkt+ERR_SPI_STREAM_HDR,&rec,fwd->base);
+    fwd->num=1;
+    return;
+  }
+  //queue is empty or the timeout expired, check if the packet is due
+  if(fwd->num){
+    due=fwd->first+fwd->delay;
+    //wait for the bus after it was busy
+    if((long)(fwd->retry-due)>0){
+      due=fwd->retry;
+    }
+    if((long)(now-due)>=0){
+      if(err_fwd_send(fwd)){
+        sink->timeout=0;
+        return;
+      }
+      due=fwd->retry;
+    }
+    //wake up when the packet is due
+    sink->timeout=((long)(due-now)>0)?due-now:1;
+  }else{
+    sink->timeout=0;
+  }
+}
+
+//forward errors to another board as SPI_ERROR_DAT packets
+int error_forward_start(ERR_FWD *fwd,unsigned char addr,unsigned char src,unsigned char level,CTL_TIME_t delay,ERROR_DAT *buf,unsigned short size,unsigned char pri,unsigned *stack,unsigned stack_size){
+  fwd->addr=addr;
+  fwd->src=src;
+  fwd->delay=delay;
+  fwd->retry=ctl_get_current_time();
+  fwd->backoff=ERR_FWD_BACKOFF_MIN;
+  fwd->seq=0;
+  fwd->len=0;
+  fwd->num=0;
+  fwd->sent=fwd->busy=fwd->lost=0;
+  return error_sink_add(&fwd->sink,"err_fwd",level,err_fwd_func,fwd,buf,size,pri,stack,stack_size);
+}
+
+//number of senders tracked by print_spi_err, bus addresses are 7 bits
+#define SPI_ERR_SENDERS   (128)
+//sequence number of the next packet from each sender and a bit set for each sender that has sent a packet
+//exports use the first entry and forwarders the second because one board can send both at once
+static unsigned short spi_err_seq[2][SPI_ERR_SENDERS];
+static unsigned char spi_err_seen[2][SPI_ERR_SENDERS/8];
+
 void print_spi_err(const unsigned char *dat,unsigned short len){
     const char *name;
-    unsigned short num;
-    int i;
+    unsigned short num,pos,end,seq=0,hdr=4;
+    int i,fwd;
     char buf[150];
     const ERROR_DAT *data;
+    ERR_REC rec;
+    ticker base;
+    //check that the header was received
+    if(len<hdr){
+        printf("Error : SPI error packet too short\r\n");
+        return;
+    }
     //check if it is a SPI error data block
     if(dat[0]!=SPI_ERROR_DAT){
         //print error and return
         printf("Error : data is not SPI error block\r\n");
         return;
     }
+    num=*(unsigned short*)(dat+2);
+    //check for a packet from a stream
+    if(num&ERR_SPI_STREAM){
+        //forwarder packets have their own sequence numbers
+        fwd=(num&ERR_SPI_FORWARD)?1:0;
+        num&=~(ERR_SPI_STREAM|ERR_SPI_FORWARD);
+        //check that the sequence number was received
+        if(len<hdr+2){
+            printf("Error : SPI error packet too short\r\n");
+            return;
+        }
+        //get sequence number
+        seq=*(unsigned short*)(dat+4);
+        hdr+=2;
+        //check for missing packets, sequence number zero starts a new stream
+        if(dat[1]<SPI_ERR_SENDERS){
+            if((seq&~ERR_SPI_LAST)!=0 && (!(spi_err_seen[fwd][dat[1]/8]&(1<<(dat[1]%8))) || (seq&~ERR_SPI_LAST)!=spi_err_seq[fwd][dat[1]])){
+                printf("Error : missing packets before packet %u\r\n",seq&~ERR_SPI_LAST);
+            }
+            spi_err_seen[fwd][dat[1]/8]|=1<<(dat[1]%8);
+            //the sequence number wraps from 0x7FFF to zero because ERR_SPI_LAST is the top bit
+            spi_err_seq[fwd][dat[1]]=(seq+1)&~ERR_SPI_LAST;
+        }
+    }
     //get sender address name
     name=I2C_addr_revlookup(dat[1],busAddrSym);
+    //print sender for every packet, packets from different senders can be mixed together
     if(name!=NULL){
         printf("Printing errors from %s (0x%02X)\r\n",name,dat[1]);
     }else{
-        printf("Printing errors from address 0x%02X\r\n",i);
+        printf("Printing errors from address 0x%02X\r\n",dat[1]);
     }
-    num=*(unsigned short*)(dat+2);
-    for(i=0,data=(const ERROR_DAT*)(dat+4);i<num;i++){
+    //check for encoded errors
+    if(num&ERR_SPI_COMPACT){
+        //get number of errors
+        num&=~ERR_SPI_COMPACT;
+        //check that the base time was received
+        if(len<hdr+sizeof(base)){
+            printf("Error : SPI error packet too short\r\n");
+            return;
+        }
+        //get base time
+        memcpy(&base,dat+hdr,sizeof(base));
+        for(i=0,pos=hdr+sizeof(base);i<num;i++,pos=end){
+            //find the end of the error
+            end=err_rec_end(dat,pos,len);
+            if(end==0){
+                printf("Error : truncated error data\r\n");
+                return;
+            }
+            //decode error
+            err_rec_decode(dat,pos,base,&rec);
+            //print message
+            print_rec(&rec,ERR_FLAGS_LIB);
+        }
+        //check for the end of a stream
+        if(seq&ERR_SPI_LAST){
+            printf("End of errors, %u packets\r\n",(seq&~ERR_SPI_LAST)+1);
+        }
+        return;
+    }
+    //check that all of the errors were received
+    if(len<hdr+num*sizeof(ERROR_DAT)){
+        printf("Error : truncated error data\r\n");
+        return;
+    }
+    for(i=0,data=(const ERROR_DAT*)(dat+hdr);i<num;i++){
+        //check for repeated error
+        if(data[i].valid==REPEAT_ERROR_MAGIC){
+            //repeat information follows the error
+            if(i+1<num && data[i+1].valid==REPEAT_INFO_MAGIC){
+                err_dat_to_rec(&data[i],&data[i+1],&rec);
+                i++;
+            }else{
+                err_dat_to_rec(&data[i],NULL,&rec);
+            }
+            //print message
+            print_rec(&rec,ERR_FLAGS_LIB);
+            continue;
+        }
         if(data[i].valid!=SAVED_ERROR_MAGIC){
             printf("Invalid error\r\n");
             continue;
         }
         //print message
-        printf("%10lu:%-14s (%3i) : %s\r\n",data[i].time,ERR_lev_str(data[i].level),data[i].level,err_do_decode(buf,data[i].source,data[i].err,data[i].argument,ERR_FLAGS_LIB));
+        printf("%10lu:%-14s (%3i) : %s\r\n",(unsigned long)data[i].time,ERR_lev_str(data[i].level),data[i].level,err_do_decode(buf,data[i].source,data[i].err,data[i].argument,ERR_FLAGS_LIB));
     }
 }
 
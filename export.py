@@ -33,7 +33,7 @@ for folder in dirs:
 #get bath to crossbuild
 crossbuild=os.path.join(rowleyPath,path,'bin','crossbuild.exe')
 
-for config in ("MSP430 printf Release","MSP430 printf Debug","MSP430 SDcard Release","MSP430 SDcard Debug"):
+for config in ("MSP430 Release","MSP430 Debug"):
 	
 	#build using crossbuild
 	print("Building "+config);
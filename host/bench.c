@@ -0,0 +1,662 @@
+//benchmarks for the error library running on the host
+//results are printed to stdout, output from the library is discarded
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <ctl.h>
+#include <ARCbus.h>
+#include "Error.h"
+#include "mock.h"
+
+//store an error directly, used by the logger task
+void record_error(unsigned char level,unsigned short source,int err, unsigned short argument,ticker time);
+
+//size of the in memory SD card in blocks
+#define BENCH_SD_BLOCKS     (16384)
+
+//where results are printed
+static FILE *out;
+
+//get time in seconds
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+//give the library tasks time to catch up
+static void settle(void){
+  usleep(200000);
+}
+
+//cost of reporting and storing errors
+static void bench_report(void){
+  const long n=200000;
+  unsigned long dropped;
+  ERR_STATS stats;
+  int top;
+  double t;
+  long i;
+  dropped=error_queue_overflows();
+  t=now();
+  for(i=0;i<n;i++){
+    report_error(ERR_LEV_ERROR,i&0xFF,i,i);
+  }
+  t=now()-t;
+  settle();
+  fprintf(out,"report_error             : %12.0f calls/s (%lu of %ld dropped by full queue)\n",n/t,error_queue_overflows()-dropped,n);
+  //errors below the level for their source are dropped before anything else is done
+  set_error_source_level(0,0xFF,ERR_LEV_ERROR);
+  t=now();
+  for(i=0;i<n;i++){
+    report_error(ERR_LEV_DEBUG,i&0xFF,i,i);
+  }
+  t=now()-t;
+  clear_error_source_level(0,0xFF);
+  fprintf(out,"report_error filtered    : %12.0f calls/s\n",n/t);
+  //the REPORT_ macros skip the call when no level lets the error through
+  set_error_level(ERR_LEV_ERROR);
+  set_error_flight_recorder(ERR_LEV_ERROR,ERR_LEV_CRITICAL);
+  t=now();
+  for(i=0;i<n;i++){
+    REPORT_DEBUG(i&0xFF,i,i);
+  }
+  t=now()-t;
+  set_error_level(ERR_LEV_DEBUG);
+  set_error_flight_recorder(ERR_LEV_DEBUG,ERR_LEV_CRITICAL);
+  fprintf(out,"REPORT_DEBUG filtered    : %12.0f calls/s\n",n/t);
+  //record_error stores the error in the calling task, this is what the logger task does for each error
+  t=now();
+  for(i=0;i<n;i++){
+    record_error(ERR_LEV_ERROR,i&0xFF,i,i,get_ticker_time());
+  }
+  t=now()-t;
+  fprintf(out,"record_error             : %12.0f calls/s\n",n/t);
+  //statistics should find a frequent source among many rare ones
+  error_stats_clear();
+  for(i=0;i<n;i++){
+    record_error(ERR_LEV_ERROR,(i&3)?0x100+(i&0x3FF):7,i,i,get_ticker_time());
+  }
+  error_stats(&stats);
+  for(i=0,top=0;i<ERR_STAT_TOP;i++){
+    if(stats.top[i].count>stats.top[top].count){
+      top=i;
+    }
+  }
+  fprintf(out,"error stats top source   : %12u (%u-%u of %ld)\n",stats.top[top].source,stats.top[top].count-stats.top[top].over,stats.top[top].count,n/4);
+}
+
+//errors handed to the bench sinks
+static volatile long sink_fast_count,sink_slow_count;
+
+//sink that only counts errors
+static void sink_fast(ERR_SINK *sink,const ERROR_DAT *err){
+  if(err){
+    sink_fast_count++;
+  }
+}
+
+//sink that takes 1 ms for each error like a slow UART
+static void sink_slow(ERR_SINK *sink,const ERROR_DAT *err){
+  if(err){
+    usleep(1000);
+    sink_slow_count++;
+  }
+}
+
+//a slow sink should not slow down reporters or a fast sink
+static void bench_sinks(void){
+  static ERR_SINK fast,slow;
+  static ERROR_DAT fast_buf[4096],slow_buf[16];
+  static unsigned fast_stack[128],slow_stack[128];
+  const long n=2000;
+  unsigned long dropped;
+  double t;
+  long i;
+  error_sink_add(&fast,"fast",ERR_LEV_DEBUG,sink_fast,NULL,fast_buf,4096,10,fast_stack,128);
+  error_sink_add(&slow,"slow",ERR_LEV_DEBUG,sink_slow,NULL,slow_buf,16,10,slow_stack,128);
+  sink_fast_count=sink_slow_count=0;
+  t=now();
+  for(i=0;i<n;i++){
+    report_error(ERR_LEV_ERROR,i&0xFF,i,i);
+  }
+  t=now()-t;
+  settle();
+  dropped=error_sink_dropped(&slow);
+  fprintf(out,"report_error with sinks  : %12.0f calls/s (fast sink %ld of %ld, slow sink %ld and %lu dropped)\n",n/t,sink_fast_count,n,sink_slow_count,dropped);
+  //stop giving errors to the bench sinks
+  error_sink_level(&fast,0xFF);
+  error_sink_level(&slow,0xFF);
+}
+
+#ifdef SD_CARD_OUTPUT
+  //SD card writes for errors arriving at a steady rate
+  static void bench_sd_writes(CTL_TIME_t timeout,long rate,long n){
+    unsigned long writes;
+    CTL_TIME_t old;
+    long i;
+    old=set_error_flush_timeout(timeout);
+    error_flush();
+    writes=mock_sd_writes;
+    for(i=0;i<n;i++){
+      record_error(ERR_LEV_ERROR,i&0xFF,i,i,get_ticker_time());
+      usleep(1000000/rate);
+    }
+    error_flush();
+    fprintf(out,"SD writes per error      : %12.3f (%ld errors at %ld/s, flush timeout %lu ms)\n",(double)(mock_sd_writes-writes)/n,n,rate,timeout);
+    set_error_flush_timeout(old);
+  }
+#endif
+
+#ifdef SD_CARD_OUTPUT
+  //SD card writes and durability lag for a mix of levels, one error in 100 is critical, one in 10 is an error and the rest are info
+  //mode sets the flush mode for every class, -1 uses the default modes
+  static void bench_flush_modes(int mode,long rate,long n){
+    ERR_FLUSH_LAG lag;
+    unsigned long writes;
+    unsigned char old[ERR_STAT_LEVELS];
+    CTL_TIME_t max_age=0;
+    long i,left=0;
+    int cls;
+    unsigned char level;
+    if(mode>=0){
+      for(cls=0;cls<ERR_STAT_LEVELS;cls++){
+        old[cls]=set_error_flush_mode(cls,mode);
+      }
+    }
+    error_flush();
+    writes=mock_sd_writes;
+    for(i=0;i<n;i++){
+      level=(i%100==0)?ERR_LEV_CRITICAL:(i%10==0)?ERR_LEV_ERROR:ERR_LEV_INFO;
+      record_error(level,i&0xFF,i,i,get_ticker_time());
+      error_flush_lag(&lag);
+      //critical errors should be on the SD card when record_error returns
+      if(level==ERR_LEV_CRITICAL && lag.unwritten){
+        left++;
+      }
+      if(lag.age>max_age){
+        max_age=lag.age;
+      }
+      usleep(1000000/rate);
+    }
+    error_flush();
+    fprintf(out,"flush %-18s : %12.3f SD writes per error, %ld of %ld critical left in RAM, %lu ms max lag\n",(mode<0)?"by level":"all delayed",(double)(mock_sd_writes-writes)/n,left,n/100,max_age);
+    if(mode>=0){
+      for(cls=0;cls<ERR_STAT_LEVELS;cls++){
+        set_error_flush_mode(cls,old[cls]);
+      }
+    }
+  }
+
+  //critical errors reported from a task, report_error_sync waits for the logger task to write them
+  static void bench_sync(long n){
+    unsigned long writes;
+    long i,written[2]={0,0};
+    double t[2]={0,0},start;
+    int sync;
+    for(sync=0;sync<2;sync++){
+      error_flush();
+      for(i=0;i<n;i++){
+        //info errors wait in RAM ahead of the critical error
+        report_error(ERR_LEV_INFO,1,i,i);
+        writes=mock_sd_writes;
+        start=now();
+        if(sync){
+          report_error_sync(ERR_LEV_CRITICAL,2,i,i);
+        }else{
+          report_error(ERR_LEV_CRITICAL,2,i,i);
+        }
+        t[sync]+=now()-start;
+        //the error is on the SD card if a block was written before the call returned
+        if(mock_sd_writes!=writes){
+          written[sync]++;
+        }
+      }
+      settle();
+    }
+    fprintf(out,"critical report          : %12.1f us average, %ld of %ld written on return\n",t[0]*1e6/n,written[0],n);
+    fprintf(out,"critical report sync     : %12.1f us average, %ld of %ld written on return\n",t[1]*1e6/n,written[1],n);
+  }
+
+  //worst case time for record_error when SD card writes are slow
+  static void bench_latency(unsigned long write_us){
+    const long n=3000;
+    double t,worst=0,total=0;
+    long i;
+    error_flush();
+    mock_sd_write_us=write_us;
+    for(i=0;i<n;i++){
+      t=now();
+      record_error(ERR_LEV_ERROR,i&0xFF,i,i,get_ticker_time());
+      t=now()-t;
+      total+=t;
+      if(t>worst){
+        worst=t;
+      }
+      usleep(200);
+    }
+    error_flush();
+    mock_sd_write_us=0;
+    fprintf(out,"record_error latency     : %12.1f us worst, %.2f us average (%lu us SD writes)\n",worst*1e6,total/n*1e6,write_us);
+  }
+#endif
+
+//fill the log so that replays have something to read, one error in 200 is critical
+static void fill_log(long n){
+  long i;
+  for(i=0;i<n;i++){
+    record_error((i%200==0)?ERR_LEV_CRITICAL:ERR_LEV_INFO,i&0xFF,i,i,get_ticker_time());
+  }
+  error_flush();
+}
+
+//errors kept through a warm reset, a fork stands in for the reset because memory is kept and the library tasks are not
+static void bench_warm_reset(void){
+  const long n=40;
+  unsigned char buf[512],dest[4096];
+  ERR_CURSOR cur;
+  long i,kept;
+  int ret;
+  pid_t pid=fork();
+  if(pid==0){
+    error_init();
+    error_recording_start();
+    //keep errors in RAM
+    set_error_flush_timeout(60000);
+    for(i=0;i<n;i++){
+      record_error(ERR_LEV_ERROR,1,i,i,get_ticker_time());
+    }
+    settle();
+    pid=fork();
+    if(pid==0){
+      error_init();
+      error_recording_start();
+      //count errors in the log
+      kept=0;
+      error_cursor_open(&cur,NULL);
+      do{
+        ret=error_cursor_next_batch(&cur,dest,sizeof(dest),buf);
+        kept+=*(unsigned short*)dest;
+      }while(ret==ERR_CURSOR_MORE);
+      fprintf(out,"warm reset               : %12ld of %ld errors kept, %u resets\n",kept,n,error_reset_count());
+      _exit(0);
+    }
+    waitpid(pid,NULL,0);
+    _exit(0);
+  }
+  waitpid(pid,NULL,0);
+  memset(mock_sd,0,mock_sd_blocks*512);
+}
+
+//packets, bytes and errors received from an export and packets out of sequence
+static unsigned long spi_pkts,spi_bytes,spi_errs,spi_bad;
+//set when the last packet of an export is received
+static int spi_done;
+
+//count exported packets and check their sequence numbers
+static void spi_count(unsigned char addr,const unsigned char *dat,unsigned short len){
+  unsigned short num=*(unsigned short*)(dat+2),seq=*(unsigned short*)(dat+4);
+  if(!(num&ERR_SPI_STREAM) || (seq&~ERR_SPI_LAST)!=spi_pkts || spi_done){
+    spi_bad++;
+  }
+  if(seq&ERR_SPI_LAST){
+    spi_done=1;
+  }
+  spi_pkts++;
+  spi_bytes+=len;
+  spi_errs+=num&~(ERR_SPI_COMPACT|ERR_SPI_STREAM);
+}
+
+//SD card reads for replays
+static void bench_replay(void){
+  unsigned char buf[512],dest[4096];
+  unsigned long reads,writes;
+  ERR_CURSOR cur;
+  long errs,batches;
+  double t;
+  int i,ret;
+  static const unsigned char levels[]={0,ERR_LEV_CRITICAL};
+  fill_log(10000);
+  for(i=0;i<sizeof(levels)/sizeof(levels[0]);i++){
+    reads=mock_sd_reads;
+    t=now();
+    error_log_replay(0,levels[i]);
+    t=now()-t;
+    fprintf(out,"error_log_replay lev %3u : %12lu bytes read in %.3f ms\n",levels[i],(mock_sd_reads-reads)*512,t*1e3);
+  }
+  for(i=0;i<sizeof(levels)/sizeof(levels[0]);i++){
+    reads=mock_sd_reads;
+    t=now();
+    error_log_mem_replay(dest,sizeof(dest),levels[i],buf);
+    t=now()-t;
+    fprintf(out,"mem_replay lev %3u       : %12lu bytes read for %u slots in %.3f ms\n",levels[i],(mock_sd_reads-reads)*512,*(unsigned short*)dest,t*1e3);
+  }
+  //download the whole log with a cursor
+  reads=mock_sd_reads;
+  errs=batches=0;
+  t=now();
+  error_cursor_open(&cur,NULL);
+  do{
+    ret=error_cursor_next_batch(&cur,dest,256,buf);
+    errs+=*(unsigned short*)dest;
+    batches++;
+  }while(ret==ERR_CURSOR_MORE);
+  error_cursor_close(&cur);
+  t=now()-t;
+  fprintf(out,"cursor 256 byte batches  : %12lu bytes read for %ld slots in %ld batches in %.3f ms\n",(mock_sd_reads-reads)*512,errs,batches,t*1e3);
+  //send the whole log over the bus, slots from the cursor would take errs*sizeof(ERROR_DAT) bytes
+  reads=mock_sd_reads;
+  spi_pkts=spi_bytes=spi_errs=spi_bad=0;
+  spi_done=0;
+  mock_spi_hook=spi_count;
+  t=now();
+  error_export_spi(BUS_ADDR_CDH,BUS_ADDR_CDH,NULL);
+  t=now()-t;
+  mock_spi_hook=NULL;
+  fprintf(out,"export 256 byte packets  : %12lu bytes sent for %lu errors in %lu packets in %.3f ms (%lu bytes as slots, %s, %lu out of sequence)\n",
+          spi_bytes,spi_errs,spi_pkts,t*1e3,(unsigned long)(errs*sizeof(ERROR_DAT)),spi_done?"complete":"incomplete",spi_bad);
+  //clearing the log should not depend on the size of the log
+  writes=mock_sd_writes;
+  t=now();
+  clear_saved_errors();
+  t=now()-t;
+  error_log_mem_replay(dest,sizeof(dest),0,buf);
+  fprintf(out,"clear_saved_errors       : %12lu blocks written in %.3f ms, %u slots left\n",mock_sd_writes-writes,t*1e3,*(unsigned short*)dest);
+}
+
+//packets, errors and sequence gaps received from the forwarder
+static unsigned long fwd_pkts,fwd_errs,fwd_gaps;
+static unsigned short fwd_seq;
+
+//count forwarded packets and check for gaps in the sequence numbers
+static void fwd_count(unsigned char addr,const unsigned char *dat,unsigned short len){
+  unsigned short num=*(unsigned short*)(dat+2),seq=*(unsigned short*)(dat+4);
+  if(seq!=fwd_seq){
+    fwd_gaps++;
+  }
+  fwd_seq=seq+1;
+  fwd_pkts++;
+  fwd_errs+=num&~(ERR_SPI_COMPACT|ERR_SPI_STREAM|ERR_SPI_FORWARD);
+}
+
+//forward errors at 1000/s with one in four above the forwarder level, the bus is busy for a while in the second half
+static void bench_forward(void){
+  static ERR_FWD fwd;
+  static ERROR_DAT buf[64];
+  static unsigned stack[128];
+  const long n=2000;
+  long i,sent=0;
+  fwd_pkts=fwd_errs=fwd_gaps=fwd_seq=0;
+  mock_spi_hook=fwd_count;
+  error_forward_start(&fwd,BUS_ADDR_CDH,BUS_ADDR_CDH,ERR_LEV_ERROR,100,buf,64,15,stack,128);
+  for(i=0;i<n;i++){
+    if(i==n/2){
+      mock_spi_busy=4;
+    }
+    if(i%4==0){
+      report_error(ERR_LEV_ERROR,i&0xFF,i,i);
+      sent++;
+    }else{
+      report_error(ERR_LEV_DEBUG,i&0xFF,i,i);
+    }
+    usleep(1000);
+  }
+  //wait for the last packet to be due
+  usleep(300000);
+  error_sink_level(&fwd.sink,0xFF);
+  mock_spi_hook=NULL;
+  fprintf(out,"forwarder 100 ms delay   : %12lu of %ld errors in %lu packets, bus busy %lu times, %lu errors lost, %lu gaps seen\n",fwd_errs,sent,fwd_pkts,fwd.busy,fwd.lost,fwd_gaps);
+}
+
+#ifdef SD_CARD_OUTPUT
+  //write a log with the given number of blocks in a child process, the log is cleared after it is written if clear is set
+  static void boot_fill(long blocks,int clear){
+    unsigned long last;
+    long used;
+    pid_t pid=fork();
+    if(pid==0){
+      error_init();
+      error_recording_start();
+      //write every error so that the address of each block is seen
+      set_error_flush_timeout(0);
+      for(used=1,last=mock_sd_last;used<blocks;){
+        record_error(ERR_LEV_INFO,1,2,3,get_ticker_time());
+        if(mock_sd_last!=last){
+          last=mock_sd_last;
+          used++;
+        }
+      }
+      if(clear){
+        clear_saved_errors();
+      }
+      _exit(0);
+    }
+    waitpid(pid,NULL,0);
+  }
+
+  //measure error_recording_start for the region from start to end in a child process so that the library starts from scratch
+  static void boot_measure(const char *name,unsigned long start,unsigned long end){
+    double t;
+    pid_t pid=fork();
+    if(pid==0){
+      error_init_region(start,end);
+      mock_sd_thread_reads=0;
+      t=now();
+      error_recording_start();
+      t=now()-t;
+      fprintf(out,"boot %-19s : %12lu blocks read in %.3f ms\n",name,mock_sd_thread_reads,t*1e3);
+      fflush(out);
+      _exit(0);
+    }
+    waitpid(pid,NULL,0);
+  }
+
+  //start recording while the bus buffer is in use, the log must not be overwritten and the next start must continue it
+  static void boot_busy(long blocks){
+    unsigned long writes;
+    int resp;
+    pid_t pid=fork();
+    if(pid==0){
+      error_init();
+      writes=mock_sd_writes;
+      mock_bus_fail=1000;
+      resp=error_recording_start();
+      mock_bus_fail=0;
+      //kept in RAM until recording starts
+      record_error(ERR_LEV_INFO,1,2,3,get_ticker_time());
+      writes=mock_sd_writes-writes;
+      mock_sd_last=0;
+      error_recording_start();
+      fprintf(out,"boot bus busy            : %12lu blocks written by failed start (%d), next start wrote block %lu, newest was %ld\n",writes,resp,mock_sd_last,ERR_LOG_BLOCK(ERR_ADDR_START)+blocks-1);
+      fflush(out);
+      _exit(0);
+    }
+    waitpid(pid,NULL,0);
+  }
+
+  //cost of finding the most recent block for logs of different sizes
+  static void bench_boot(void){
+    const long region=ERR_ADDR_END-ERR_LOG_BLOCK(ERR_ADDR_START)+1;
+    static const struct{
+      const char *name;
+      //blocks in region, fraction of the region that is used
+      int num,den;
+      //damage the first block
+      int corrupt;
+      //clear the log after it is written
+      int clear;
+    }cases[]={{"empty",0,1,0,0},{"1 block",1,region,0,0},{"half full",1,2,0,0},{"full",1,1,0,0},{"wrapped",3,2,0,0},{"first block damaged",3,2,1,0},{"cleared",3,2,0,1}};
+    int i;
+    for(i=0;i<sizeof(cases)/sizeof(cases[0]);i++){
+      memset(mock_sd,0,mock_sd_blocks*512);
+      if(cases[i].num){
+        boot_fill(region*cases[i].num/cases[i].den,cases[i].clear);
+      }
+      if(cases[i].corrupt){
+        mock_sd[ERR_LOG_BLOCK(ERR_ADDR_START)*512+100]^=0xFF;
+      }
+      boot_measure(cases[i].name,ERR_ADDR_START,ERR_ADDR_END);
+    }
+    memset(mock_sd,0,mock_sd_blocks*512);
+    boot_fill(region/2,0);
+    boot_busy(region/2);
+    memset(mock_sd,0,mock_sd_blocks*512);
+  }
+#endif
+
+#ifdef SD_CARD_OUTPUT
+  //list and print saved snapshots, the output goes to stdout which is discarded
+  static void bench_snapshots(void){
+    unsigned long reads;
+    double t;
+    int i;
+    //save more snapshots than there are slots so that the slots wrap
+    for(i=0;i<ERR_SNAP_SLOTS+2;i++){
+      report_error(ERR_LEV_CRITICAL,i,i,i);
+      settle();
+    }
+    reads=mock_sd_thread_reads;
+    t=now();
+    error_snapshot_list();
+    t=now()-t;
+    fprintf(out,"error_snapshot_list      : %12lu blocks read in %.3f ms\n",mock_sd_thread_reads-reads,t*1e3);
+    reads=mock_sd_thread_reads;
+    t=now();
+    error_snapshot_dump(0);
+    t=now()-t;
+    fprintf(out,"error_snapshot_dump      : %12lu blocks read in %.3f ms\n",mock_sd_thread_reads-reads,t*1e3);
+  }
+#endif
+
+#ifdef SD_CARD_OUTPUT
+  //fill an error log of the given size and replay all of it in a child process
+  //each SD card command takes 100 us so that the cost of single block transfers shows up
+  static void bench_region(unsigned long blocks){
+    unsigned char buf[512],dest[4096];
+    unsigned long writes,wcmds,cmds,reads;
+    char name[32];
+    ERR_CURSOR cur;
+    ERR_FILTER filter;
+    long i,errs;
+    double t;
+    int ret;
+    pid_t pid=fork();
+    if(pid==0){
+      memset(mock_sd,0,mock_sd_blocks*512);
+      //start the region after the first block so that the start address is not zero, the log follows the snapshots
+      error_init_region(1,ERR_LOG_BLOCK(1)+blocks-1);
+      error_recording_start();
+      //write errors until the last block in the region has been written
+      writes=mock_sd_writes;
+      wcmds=mock_sd_cmds;
+      for(i=0;!mock_sd[(ERR_LOG_BLOCK(1)+blocks-1)*512];i++){
+        record_error((i%200==0)?ERR_LEV_ERROR:ERR_LEV_INFO,i&0xFF,i,i,get_ticker_time());
+      }
+      error_flush();
+      writes=mock_sd_writes-writes;
+      wcmds=mock_sd_cmds-wcmds;
+      //read the whole log, only reads by this thread are counted because the flusher task reads blocks to build the index
+      mock_sd_cmd_us=100;
+      reads=mock_sd_thread_reads;
+      cmds=mock_sd_thread_cmds;
+      errs=0;
+      t=now();
+      error_cursor_open(&cur,NULL);
+      do{
+        ret=error_cursor_next_batch(&cur,dest,sizeof(dest),buf);
+        errs+=*(unsigned short*)dest;
+      }while(ret==ERR_CURSOR_MORE);
+      error_cursor_close(&cur);
+      t=now()-t;
+      fprintf(out,"region %5lu blocks      : %12.2f blocks per write, %lu blocks read in %lu commands in %.1f ms for %ld errors\n",
+              blocks,(double)writes/wcmds,mock_sd_thread_reads-reads,mock_sd_thread_cmds-cmds,t*1e3,errs);
+      //look for errors that are not in the log, only blocks older than the index covers are read
+      error_filter_init(&filter,ERR_LEV_CRITICAL);
+      reads=mock_sd_thread_reads;
+      t=now();
+      error_log_mem_replay_filter(dest,sizeof(dest),&filter,buf);
+      t=now()-t;
+      fprintf(out,"region %5lu filtered    : %12lu of %lu blocks read in %.1f ms for %u errors\n",
+              blocks,mock_sd_thread_reads-reads,blocks,t*1e3,*(unsigned short*)dest);
+      fflush(out);
+      _exit(0);
+    }
+    waitpid(pid,NULL,0);
+    //cost of finding the most recent block in the full region
+    snprintf(name,sizeof(name),"region %lu blocks",blocks);
+    boot_measure(name,1,ERR_LOG_BLOCK(1)+blocks-1);
+    memset(mock_sd,0,mock_sd_blocks*512);
+  }
+#endif
+
+//latency measured by the library when built with ERR_LATENCY_STATS
+static void bench_lat_stats(void){
+  static const char *const names[ERR_LAT_PHASES]={"report","mutex wait","SD write","print"};
+  ERR_LAT_STATS stats;
+  int i;
+  if(!error_latency_stats(&stats)){
+    return;
+  }
+  for(i=0;i<ERR_LAT_PHASES;i++){
+    if(stats.phase[i].count){
+      fprintf(out,"latency %-16s : %8lu us mean, %5u us max (%lu times)\n",names[i],stats.phase[i].total/stats.phase[i].count,stats.phase[i].max,stats.phase[i].count);
+    }
+  }
+  fprintf(out,"lock timeouts, SD fails  : %12lu, %lu\n",stats.timeouts,stats.sd_fail);
+}
+
+//results are printed to stdout, if a file name is given the SD card image is saved to it at the end
+int main(int argc,char **argv){
+  FILE *img;
+  //keep output from the library out of the results
+  fflush(stdout);
+  out=fdopen(dup(STDOUT_FILENO),"w");
+  setvbuf(out,NULL,_IOLBF,0);
+  if(!freopen("/dev/null","w",stdout)){
+    return 1;
+  }
+  mock_sd_init(BENCH_SD_BLOCKS);
+  #ifdef SD_CARD_OUTPUT
+    fprintf(out,"SD card variant, log of %d blocks\n",ERR_ADDR_END-ERR_LOG_BLOCK(ERR_ADDR_START)+1);
+    //run before the library is used in this process
+    bench_boot();
+    bench_region(ERR_ADDR_END-ERR_LOG_BLOCK(ERR_ADDR_START)+1);
+    bench_region(1024);
+    bench_region(8192);
+  #else
+    fprintf(out,"printf variant\n");
+  #endif
+  bench_warm_reset();
+  error_init();
+  error_recording_start();
+  //count every error
+  set_error_repeat_window(0);
+  bench_report();
+  bench_sinks();
+  #ifdef SD_CARD_OUTPUT
+    bench_sd_writes(0,1000,500);
+    bench_sd_writes(1024,1000,2000);
+    bench_sd_writes(1024,100,300);
+    bench_flush_modes(ERR_FLUSH_DELAY,1000,2000);
+    bench_flush_modes(-1,1000,2000);
+    bench_latency(2000);
+    bench_sync(200);
+    bench_snapshots();
+  #endif
+  bench_replay();
+  bench_lat_stats();
+  bench_forward();
+  //save the SD card image for errdump
+  if(argc>1){
+    img=fopen(argv[1],"wb");
+    if(!img || fwrite(mock_sd,512,mock_sd_blocks,img)!=mock_sd_blocks){
+      perror(argv[1]);
+      return 1;
+    }
+    fclose(img);
+  }
+  return 0;
+}
@@ -0,0 +1,592 @@
+//decode the error log from a raw SD card image on the host
+//the image is memory mapped and blocks are checked and decoded by several threads
+//
+//  errdump [options] image
+//    -r start:end    error region in blocks, default is the library default region, "all" uses the whole image
+//                    the log is read from the blocks after the superblock and the snapshots at the start of the region
+//    -l level        lowest error level to print
+//    -s min[:max]    range of error sources to print
+//    -t min:max      range of ticker times to print
+//    -e epoch        log epoch to print, "all" prints every epoch, the default is the epoch from the superblock
+//                    at the start of the region or the newest epoch if there is no superblock
+//    -f format       output format: text, csv or json
+//    -m map          load a decode map, can be given more than once
+//    -j threads      number of threads, default is the number of CPUs
+//
+//Decode maps give the same results as the decode handlers registered with err_register_handler.
+//Each line is one of:
+//    src min[-max] name              name of a range of error sources, registered as a decode handler
+//    err min[-max] code text         text for an error code from a range of sources
+//Blank lines and lines starting with # are ignored.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ARCbus.h>
+#include "Error.h"
+
+//decode errors with the registered handlers, from the library
+const char *err_do_decode(char buf[150],unsigned short source,int err, unsigned short argument,unsigned short flags);
+const char* ERR_lev_str(unsigned char level);
+
+//blocks decoded by a thread at a time
+#define DUMP_UNIT_BLOCKS    (256)
+//number of units that can be decoded ahead of the output for each thread
+#define DUMP_UNITS_AHEAD    (4)
+
+enum{FMT_TEXT=0,FMT_CSV,FMT_JSON};
+
+//source range from a decode map
+typedef struct{
+  unsigned short min,max;
+  char *name;
+}MAP_SRC;
+
+//error text from a decode map
+typedef struct{
+  unsigned short min,max;
+  int err;
+  char *text;
+}MAP_ERR;
+
+static MAP_SRC *map_src;
+static int map_nsrc;
+static MAP_ERR *map_err;
+static int map_nerr;
+
+//block from the image
+typedef struct{
+  //result from error_block_info
+  int status;
+  ERR_BLK_INFO info;
+}DUMP_BLK;
+
+//group of blocks decoded by one thread
+typedef struct{
+  //output for the blocks
+  char *out;
+  size_t len;
+  //set when the output is ready
+  int done;
+}DUMP_UNIT;
+
+//memory mapped image
+static const unsigned char *img;
+//region of the image to read
+static unsigned long reg_start,reg_blocks;
+//blocks in the region
+static DUMP_BLK *blks;
+//indexes of the blocks to decode in the order they were written
+static unsigned long *order;
+static unsigned long norder;
+//filter and output format
+static ERR_FILTER filter;
+static int fmt=FMT_TEXT;
+//number of threads
+static int nthreads;
+
+//work shared between the decode threads
+static DUMP_UNIT *units;
+static unsigned long nunits,next_unit,written;
+static pthread_mutex_t unit_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t unit_cond=PTHREAD_COND_INITIALIZER;
+
+//find the source range for a source
+static const MAP_SRC *map_find_src(unsigned short source){
+  int lo=0,hi=map_nsrc,mid;
+  while(lo<hi){
+    mid=(lo+hi)/2;
+    if(map_src[mid].max<source){
+      lo=mid+1;
+    }else{
+      hi=mid;
+    }
+  }
+  return (lo<map_nsrc && map_src[lo].min<=source)?&map_src[lo]:NULL;
+}
+
+//find the text for an error code
+static const MAP_ERR *map_find_err(unsigned short source,int err){
+  int i;
+  //error texts are sorted by code so only errors with the right code are checked
+  int lo=0,hi=map_nerr,mid;
+  while(lo<hi){
+    mid=(lo+hi)/2;
+    if(map_err[mid].err<err){
+      lo=mid+1;
+    }else{
+      hi=mid;
+    }
+  }
+  for(i=lo;i<map_nerr && map_err[i].err==err;i++){
+    if(map_err[i].min<=source && map_err[i].max>=source){
+      return &map_err[i];
+    }
+  }
+  return NULL;
+}
+
+//decode handler for sources from decode maps
+static const char *map_decode(char buf[150],unsigned short source,int err, unsigned short argument){
+  const MAP_SRC *src=map_find_src(source);
+  const MAP_ERR *e=map_find_err(source,err);
+  if(e){
+    snprintf(buf,150,"%s : %s, argument = %u",src?src->name:"",e->text,argument);
+  }else{
+    snprintf(buf,150,"%s : error = %i, argument = %u",src?src->name:"",err,argument);
+  }
+  return buf;
+}
+
+//sort source ranges by address
+static int map_src_cmp(const void *a,const void *b){
+  return (int)((const MAP_SRC*)a)->min-(int)((const MAP_SRC*)b)->min;
+}
+
+//sort error texts by code
+static int map_err_cmp(const void *a,const void *b){
+  int ea=((const MAP_ERR*)a)->err,eb=((const MAP_ERR*)b)->err;
+  return (ea>eb)-(ea<eb);
+}
+
+//parse a source range, returns 0 on error
+static int parse_range(const char *str,unsigned short *min,unsigned short *max,char sep){
+  char *end;
+  unsigned long v=strtoul(str,&end,0);
+  *min=*max=v;
+  if(end==str || v>0xFFFF){
+    return 0;
+  }
+  if(*end==sep){
+    str=end+1;
+    v=strtoul(str,&end,0);
+    if(end==str || v>0xFFFF || v<*min){
+      return 0;
+    }
+    *max=v;
+  }
+  return *end=='\0' || *end==' ' || *end=='\t';
+}
+
+//load a decode map, returns 0 on error
+static int map_load(const char *name){
+  char line[256],*p,*range,*rest;
+  unsigned short min,max;
+  int num=0;
+  long err;
+  FILE *f=fopen(name,"r");
+  if(!f){
+    perror(name);
+    return 0;
+  }
+  while(fgets(line,sizeof(line),f)){
+    num++;
+    //remove end of line
+    line[strcspn(line,"\r\n")]='\0';
+    p=line+strspn(line," \t");
+    //skip blank lines and comments
+    if(*p=='\0' || *p=='#'){
+      continue;
+    }
+    range=p+strcspn(p," \t");
+    range+=strspn(range," \t");
+    if(!parse_range(range,&min,&max,'-')){
+      fprintf(stderr,"%s:%i: bad source range\n",name,num);
+      fclose(f);
+      return 0;
+    }
+    rest=range+strcspn(range," \t");
+    rest+=strspn(rest," \t");
+    if(!strncmp(p,"src",3)){
+      map_src=realloc(map_src,(map_nsrc+1)*sizeof(*map_src));
+      map_src[map_nsrc].min=min;
+      map_src[map_nsrc].max=max;
+      map_src[map_nsrc].name=strdup(rest);
+      map_nsrc++;
+    }else if(!strncmp(p,"err",3)){
+      err=strtol(rest,&p,0);
+      if(p==rest){
+        fprintf(stderr,"%s:%i: bad error code\n",name,num);
+        fclose(f);
+        return 0;
+      }
+      p+=strspn(p," \t");
+      map_err=realloc(map_err,(map_nerr+1)*sizeof(*map_err));
+      map_err[map_nerr].min=min;
+      map_err[map_nerr].max=max;
+      map_err[map_nerr].err=err;
+      map_err[map_nerr].text=strdup(p);
+      map_nerr++;
+    }else{
+      fprintf(stderr,"%s:%i: unknown entry\n",name,num);
+      fclose(f);
+      return 0;
+    }
+  }
+  fclose(f);
+  return 1;
+}
+
+//register a decode handler for each source range in the maps
+static int map_register(void){
+  int i;
+  qsort(map_src,map_nsrc,sizeof(*map_src),map_src_cmp);
+  qsort(map_err,map_nerr,sizeof(*map_err),map_err_cmp);
+  for(i=0;i<map_nsrc;i++){
+    switch(err_register_handler(map_src[i].min,map_src[i].max,map_decode,ERR_FLAGS_LIB|ERR_FLAGS_SUBSYSTEM)){
+      case RET_SUCCESS:
+        break;
+      case ERR_OVERLAP:
+        fprintf(stderr,"source range %u-%u overlaps another range\n",map_src[i].min,map_src[i].max);
+        return 0;
+      default:
+        fprintf(stderr,"too many source ranges, rebuild with a larger ERR_NUM_HANDLERS\n");
+        return 0;
+    }
+  }
+  return 1;
+}
+
+//write a string with quotes for CSV or JSON
+static void put_str(FILE *f,const char *str){
+  fputc('"',f);
+  for(;*str;str++){
+    if(*str=='"'){
+      fputs(fmt==FMT_CSV?"\"\"":"\\\"",f);
+    }else if(fmt==FMT_JSON && *str=='\\'){
+      fputs("\\\\",f);
+    }else if(fmt==FMT_JSON && (unsigned char)*str<0x20){
+      fprintf(f,"\\u%04x",*str);
+    }else{
+      fputc(*str,f);
+    }
+  }
+  fputc('"',f);
+}
+
+//print a decoded error
+static void dump_err(void *arg,const ERROR_DAT *dat,unsigned short repeat,ticker first){
+  FILE *f=arg;
+  char buf[150];
+  const char *msg=err_do_decode(buf,dat->source,dat->err,dat->argument,0);
+  switch(fmt){
+    case FMT_TEXT:
+      if(repeat){
+        fprintf(f,"%10lu:%-14s (%3i) : repeated x%u since %lu : %s\n",(unsigned long)dat->time,ERR_lev_str(dat->level),dat->level,repeat,(unsigned long)first,msg);
+      }else{
+        fprintf(f,"%10lu:%-14s (%3i) : %s\n",(unsigned long)dat->time,ERR_lev_str(dat->level),dat->level,msg);
+      }
+      break;
+    case FMT_CSV:
+      fprintf(f,"%lu,%u,%s,%u,%i,%u,%u,%lu,",(unsigned long)dat->time,dat->level,ERR_lev_str(dat->level),dat->source,dat->err,dat->argument,repeat,(unsigned long)(repeat?first:dat->time));
+      put_str(f,msg);
+      fputc('\n',f);
+      break;
+    case FMT_JSON:
+      //every error starts with a separator, the first one is removed when the output is written
+      fprintf(f,",\n  {\"time\":%lu,\"level\":%u,\"source\":%u,\"error\":%i,\"argument\":%u,\"repeat\":%u,\"first\":%lu,\"message\":",
+              (unsigned long)dat->time,dat->level,dat->source,dat->err,dat->argument,repeat,(unsigned long)(repeat?first:dat->time));
+      put_str(f,msg);
+      fputc('}',f);
+      break;
+  }
+}
+
+//check a part of the region
+static void *check_func(void *arg){
+  long t=(long)arg;
+  unsigned long i,end=reg_blocks*(t+1)/nthreads;
+  for(i=reg_blocks*t/nthreads;i<end;i++){
+    blks[i].status=error_block_info(img+(reg_start+i)*512,&blks[i].info);
+  }
+  return NULL;
+}
+
+//decode units of blocks in order, units are not started too far ahead of the output so memory use is limited
+static void *decode_func(void *arg){
+  unsigned long u,i,end;
+  FILE *f;
+  for(;;){
+    pthread_mutex_lock(&unit_lock);
+    while(next_unit<nunits && next_unit>=written+DUMP_UNITS_AHEAD*nthreads){
+      pthread_cond_wait(&unit_cond,&unit_lock);
+    }
+    u=next_unit++;
+    pthread_mutex_unlock(&unit_lock);
+    if(u>=nunits){
+      return NULL;
+    }
+    f=open_memstream(&units[u].out,&units[u].len);
+    end=(u+1)*DUMP_UNIT_BLOCKS;
+    for(i=u*DUMP_UNIT_BLOCKS;i<norder && i<end;i++){
+      error_block_decode(img+(reg_start+order[i])*512,&filter,dump_err,f);
+    }
+    fclose(f);
+    pthread_mutex_lock(&unit_lock);
+    units[u].done=1;
+    pthread_cond_broadcast(&unit_cond);
+    pthread_mutex_unlock(&unit_lock);
+  }
+}
+
+//start func on each thread
+static pthread_t *start_threads(void *(*func)(void*)){
+  pthread_t *th=malloc(nthreads*sizeof(*th));
+  long t;
+  for(t=0;t<nthreads;t++){
+    pthread_create(&th[t],NULL,func,(void*)t);
+  }
+  return th;
+}
+
+//wait for threads to finish
+static void join_threads(pthread_t *th){
+  int t;
+  for(t=0;t<nthreads;t++){
+    pthread_join(th[t],NULL);
+  }
+  free(th);
+}
+
+//decode the blocks in order and write the output as each unit is finished
+static void write_output(void){
+  pthread_t *th;
+  unsigned long u;
+  int first=1;
+  nunits=(norder+DUMP_UNIT_BLOCKS-1)/DUMP_UNIT_BLOCKS;
+  units=calloc(nunits+1,sizeof(*units));
+  th=start_threads(decode_func);
+  for(u=0;u<nunits;u++){
+    pthread_mutex_lock(&unit_lock);
+    while(!units[u].done){
+      pthread_cond_wait(&unit_cond,&unit_lock);
+    }
+    pthread_mutex_unlock(&unit_lock);
+    if(units[u].len){
+      //remove the separator before the first JSON error
+      if(fmt==FMT_JSON && first){
+        fwrite(units[u].out+1,1,units[u].len-1,stdout);
+      }else{
+        fwrite(units[u].out,1,units[u].len,stdout);
+      }
+      first=0;
+    }
+    free(units[u].out);
+    //let threads start more units
+    pthread_mutex_lock(&unit_lock);
+    written=u+1;
+    pthread_cond_broadcast(&unit_cond);
+    pthread_mutex_unlock(&unit_lock);
+  }
+  join_threads(th);
+}
+
+//newest epoch or block number, values are less than half the number range apart
+static unsigned short newest(unsigned short a,unsigned short b){
+  return ((short)(b-a)>0)?b:a;
+}
+
+//epoch and block number that blocks are sorted relative to
+static unsigned short sort_epoch,*sort_head;
+
+//sort blocks by epoch and then by block number
+static int order_cmp(const void *a,const void *b){
+  const ERR_BLK_INFO *ia=&blks[*(const unsigned long*)a].info,*ib=&blks[*(const unsigned long*)b].info;
+  short ea=ia->epoch-sort_epoch,eb=ib->epoch-sort_epoch;
+  short na,nb;
+  if(ea!=eb){
+    return (ea>eb)-(ea<eb);
+  }
+  na=ia->number-sort_head[ia->epoch];
+  nb=ib->number-sort_head[ib->epoch];
+  return (na>nb)-(na<nb);
+}
+
+static void usage(const char *name){
+  fprintf(stderr,"usage: %s [-r start:end|all] [-l level] [-s min[:max]] [-t min:max] [-e epoch|all] [-f text|csv|json] [-m map]... [-j threads] image\n",name);
+  exit(2);
+}
+
+int main(int argc,char **argv){
+  unsigned long good=0,bad=0,other=0,i,size,super;
+  unsigned long start=ERR_ADDR_START,end=ERR_ADDR_END;
+  long epoch=-1;
+  int all_region=0,all_epochs=0,c,fd;
+  unsigned short min,max,newest_epoch=0;
+  unsigned char *seen;
+  ERR_BLK_INFO info;
+  struct stat st;
+  char *p;
+  error_filter_init(&filter,0);
+  nthreads=sysconf(_SC_NPROCESSORS_ONLN);
+  while((c=getopt(argc,argv,"r:l:s:t:e:f:m:j:"))!=-1){
+    switch(c){
+      case 'r':
+        if(!strcmp(optarg,"all")){
+          all_region=1;
+        }else{
+          start=strtoul(optarg,&p,0);
+          if(*p!=':'){
+            usage(argv[0]);
+          }
+          end=strtoul(p+1,&p,0);
+          if(*p || end<ERR_LOG_BLOCK(start)){
+            usage(argv[0]);
+          }
+        }
+        break;
+      case 'l':
+        filter.level=strtoul(optarg,NULL,0);
+        break;
+      case 's':
+        if(!parse_range(optarg,&min,&max,':')){
+          usage(argv[0]);
+        }
+        filter.src_min=min;
+        filter.src_max=max;
+        break;
+      case 't':
+        filter.t_min=strtoul(optarg,&p,0);
+        if(*p!=':'){
+          usage(argv[0]);
+        }
+        filter.t_max=strtoul(p+1,NULL,0);
+        break;
+      case 'e':
+        if(!strcmp(optarg,"all")){
+          all_epochs=1;
+        }else{
+          epoch=strtoul(optarg,NULL,0)&0xFFFF;
+        }
+        break;
+      case 'f':
+        if(!strcmp(optarg,"text")){
+          fmt=FMT_TEXT;
+        }else if(!strcmp(optarg,"csv")){
+          fmt=FMT_CSV;
+        }else if(!strcmp(optarg,"json")){
+          fmt=FMT_JSON;
+        }else{
+          usage(argv[0]);
+        }
+        break;
+      case 'm':
+        if(!map_load(optarg)){
+          return 1;
+        }
+        break;
+      case 'j':
+        nthreads=atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if(optind!=argc-1){
+    usage(argv[0]);
+  }
+  if(nthreads<1){
+    nthreads=1;
+  }
+  if(!map_register()){
+    return 1;
+  }
+  //map the image
+  fd=open(argv[optind],O_RDONLY);
+  if(fd<0 || fstat(fd,&st)<0){
+    perror(argv[optind]);
+    return 1;
+  }
+  size=st.st_size/512;
+  //the superblock is the first block of the region
+  super=ERR_SUPER_BLOCK(start);
+  if(all_region){
+    start=0;
+    end=size-1;
+  }else{
+    //skip the superblock and the snapshots at the start of the region
+    start=ERR_LOG_BLOCK(start);
+  }
+  if(size==0 || start>=size){
+    fprintf(stderr,"%s: region starts past the end of the image\n",argv[optind]);
+    return 1;
+  }
+  //use the part of the region that is in the image
+  if(end>=size){
+    end=size-1;
+  }
+  img=mmap(NULL,size*512,PROT_READ,MAP_SHARED,fd,0);
+  if(img==MAP_FAILED){
+    perror(argv[optind]);
+    return 1;
+  }
+  madvise((void*)img,size*512,MADV_SEQUENTIAL);
+  reg_start=start;
+  reg_blocks=end-start+1;
+  //check every block in the region
+  blks=malloc(reg_blocks*sizeof(*blks));
+  if(reg_blocks<(unsigned long)nthreads){
+    nthreads=reg_blocks;
+  }
+  join_threads(start_threads(check_func));
+  //find the newest epoch
+  for(i=0;i<reg_blocks;i++){
+    if(blks[i].status==ERR_BLK_OK){
+      newest_epoch=good?newest(newest_epoch,blks[i].info.epoch):blks[i].info.epoch;
+      good++;
+    }else if(blks[i].status==ERR_BLK_BAD_CRC){
+      bad++;
+    }
+  }
+  //use the same epoch as the library, the superblock epoch unless the first block is newer
+  if(epoch<0 && !all_region && super<size && error_block_info(img+super*512,&info)==ERR_BLK_SUPER){
+    epoch=info.epoch;
+    if(blks[0].status==ERR_BLK_OK && (short)(blks[0].info.epoch-epoch)>0){
+      epoch=blks[0].info.epoch;
+    }
+    newest_epoch=newest(newest_epoch,epoch);
+  }
+  //without a superblock use the newest blocks
+  if(epoch<0){
+    epoch=newest_epoch;
+  }
+  //find the newest block in each epoch
+  sort_head=calloc(0x10000,sizeof(*sort_head));
+  seen=calloc(0x10000,1);
+  order=malloc(reg_blocks*sizeof(*order));
+  for(i=0;i<reg_blocks;i++){
+    if(blks[i].status!=ERR_BLK_OK){
+      continue;
+    }
+    if(!all_epochs && blks[i].info.epoch!=(unsigned short)epoch){
+      other++;
+      continue;
+    }
+    if(!seen[blks[i].info.epoch]){
+      seen[blks[i].info.epoch]=1;
+      sort_head[blks[i].info.epoch]=blks[i].info.number;
+    }else{
+      sort_head[blks[i].info.epoch]=newest(sort_head[blks[i].info.epoch],blks[i].info.number);
+    }
+    order[norder++]=i;
+  }
+  free(seen);
+  //put blocks in the order that they were written, older epochs first
+  sort_epoch=newest_epoch+1;
+  qsort(order,norder,sizeof(*order),order_cmp);
+  fprintf(stderr,"%lu blocks, %lu good, %lu bad CRC, %lu from other epochs, decoding %lu blocks with %i threads\n",reg_blocks,good,bad,other,norder,nthreads);
+  if(fmt==FMT_CSV){
+    printf("time,level,level_name,source,error,argument,repeat,first,message\n");
+  }else if(fmt==FMT_JSON){
+    printf("[");
+  }
+  write_output();
+  if(fmt==FMT_JSON){
+    printf("\n]\n");
+  }
+  return 0;
+}
@@ -0,0 +1,28 @@
+//host stand-in for the parts of ARCbus used by the error library
+#ifndef __ARCBUS_H
+#define __ARCBUS_H
+#include <ctl.h>
+
+//ticker time, counts at 1024 Hz
+typedef unsigned int ticker;
+
+enum{RET_SUCCESS=0,ERR_BUSY=-5};
+enum{SPI_ERROR_DAT=5};
+enum{BUS_ADDR_CDH=0x14};
+
+typedef struct{
+  const char *name;
+  unsigned char addr;
+}SYM_ADDR;
+
+extern const SYM_ADDR busAddrSym[];
+const char *I2C_addr_revlookup(unsigned char addr,const SYM_ADDR *syms);
+
+ticker get_ticker_time(void);
+
+unsigned char *BUS_get_buffer(CTL_TIMEOUT_t t,CTL_TIME_t timeout);
+void BUS_free_buffer(void);
+
+int BUS_SPI_txrx(unsigned char addr,unsigned char *tx,unsigned char *rx,unsigned short len);
+
+#endif
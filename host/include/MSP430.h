@@ -0,0 +1,12 @@
+//host stand-in for the MSP430 register definitions
+#ifndef __MSP430_H
+#define __MSP430_H
+
+#define BIT0  (0x0001)
+#define BIT1  (0x0002)
+
+//timer A counter, counts in us on the host
+unsigned short mock_timer_read(void);
+#define TA0R  (mock_timer_read())
+
+#endif
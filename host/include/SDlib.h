@@ -0,0 +1,20 @@
+//host stand-in for the SD card library, the card is kept in memory
+#ifndef __SDLIB_H
+#define __SDLIB_H
+#include <ctl.h>
+
+typedef unsigned long SD_block_addr;
+
+enum{MMC_SUCCESS=0,MMC_INIT_ERROR=-1,MMC_ADDRESS_ERROR=-2,MMC_LOCK_TIMEOUT_ERROR=-3};
+
+int mmcInit_card(void);
+int mmcLock(CTL_TIMEOUT_t t,CTL_TIME_t timeout);
+void mmcUnlock(void);
+int mmcReadBlock(SD_block_addr addr,unsigned char *buf);
+int mmcWriteBlock(SD_block_addr addr,const unsigned char *buf);
+int mmcReadBlocks(SD_block_addr addr,unsigned short count,unsigned char *buf);
+int mmcWriteMultiBlock(SD_block_addr addr,const unsigned char *buf,unsigned short count);
+int mmcErase(SD_block_addr start,SD_block_addr end);
+const char *SD_error_str(int error);
+
+#endif
@@ -0,0 +1,5 @@
+//host stand-in for commandLib, nothing from it is used by the error library
+#ifndef __COMMANDLIB_H
+#define __COMMANDLIB_H
+
+#endif
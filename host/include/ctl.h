@@ -0,0 +1,43 @@
+//host stand-in for the CTL tasking library, tasks are run as POSIX threads
+#ifndef __CTL_H
+#define __CTL_H
+#include <pthread.h>
+
+typedef unsigned long CTL_TIME_t;
+typedef unsigned CTL_EVENT_SET_t;
+
+//mutexes are recursive like CTL mutexes
+typedef struct{
+  pthread_mutex_t m;
+  //id used to check the order that locks are taken in, zero until the mutex is first used
+  int id;
+}CTL_MUTEX_t;
+
+typedef struct{
+  pthread_t thread;
+}CTL_TASK_t;
+
+typedef enum{CTL_TIMEOUT_NONE,CTL_TIMEOUT_INFINITE,CTL_TIMEOUT_ABSOLUTE,CTL_TIMEOUT_DELAY,CTL_TIMEOUT_NOW}CTL_TIMEOUT_t;
+typedef enum{CTL_EVENT_WAIT_ANY_EVENTS,CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,CTL_EVENT_WAIT_ALL_EVENTS,CTL_EVENT_WAIT_ALL_EVENTS_WITH_AUTO_CLEAR}CTL_EVENT_WAIT_TYPE_t;
+
+void ctl_mutex_init(CTL_MUTEX_t *m);
+unsigned ctl_mutex_lock(CTL_MUTEX_t *m,CTL_TIMEOUT_t t,CTL_TIME_t timeout);
+void ctl_mutex_unlock(CTL_MUTEX_t *m);
+
+void ctl_events_init(CTL_EVENT_SET_t *e,CTL_EVENT_SET_t set);
+void ctl_events_set_clear(CTL_EVENT_SET_t *e,CTL_EVENT_SET_t set,CTL_EVENT_SET_t clear);
+unsigned ctl_events_wait(CTL_EVENT_WAIT_TYPE_t type,CTL_EVENT_SET_t *e,CTL_EVENT_SET_t mask,CTL_TIMEOUT_t t,CTL_TIME_t timeout);
+
+void ctl_task_run(CTL_TASK_t *task,unsigned char pri,void (*func)(void*),void *p,const char *name,unsigned stack_size,unsigned *stack,unsigned call_size);
+
+//time in ms since the program started
+CTL_TIME_t ctl_get_current_time(void);
+void ctl_timeout_wait(CTL_TIME_t t);
+
+//masking interrupts takes a global lock
+int ctl_global_interrupts_set(int en);
+
+//always zero, there are no interrupts on the host
+extern unsigned char ctl_interrupt_count;
+
+#endif
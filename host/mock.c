@@ -0,0 +1,468 @@
+//host stand-ins for CTL, ARCbus and the SD card library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <ctl.h>
+#include <ARCbus.h>
+#include <SDlib.h>
+#include "mock.h"
+
+//=========================[CTL]=========================
+
+unsigned char ctl_interrupt_count;
+
+//lock held while interrupts are disabled
+static pthread_mutex_t irq_lock=PTHREAD_MUTEX_INITIALIZER;
+static __thread int irq_en=1;
+
+//all event sets share one lock and condition
+static pthread_mutex_t ev_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ev_cond=PTHREAD_COND_INITIALIZER;
+
+//lock order checking, every lock gets an id and the order that locks are taken in is recorded
+//taking two locks in opposite orders can deadlock so the program is stopped the first time it happens
+#define LOCK_MAX        (64)
+#define LOCK_HELD_MAX   (16)
+static const void *lock_addr[LOCK_MAX];
+static const char *lock_name[LOCK_MAX];
+static int lock_num;
+//lock_after[a][b] is set once lock b has been taken while holding lock a
+static unsigned char lock_after[LOCK_MAX][LOCK_MAX];
+static pthread_mutex_t lock_order_lock=PTHREAD_MUTEX_INITIALIZER;
+//locks held by the calling thread, most recent last
+static __thread int lock_held[LOCK_HELD_MAX];
+static __thread int lock_nheld;
+
+//get the id of a lock, the same lock always gets the same id
+static int lock_id(const void *addr,const char *name){
+  int i;
+  pthread_mutex_lock(&lock_order_lock);
+  for(i=0;i<lock_num && lock_addr[i]!=addr;i++);
+  if(i==lock_num){
+    if(lock_num==LOCK_MAX){
+      fprintf(stderr,"lock order: too many locks\n");
+      abort();
+    }
+    lock_addr[i]=addr;
+    lock_name[i]=name;
+    lock_num++;
+  }
+  pthread_mutex_unlock(&lock_order_lock);
+  return i+1;
+}
+
+//check if lock b has been taken while holding lock a, directly or through other locks
+static int lock_before(int a,int b){
+  int i;
+  if(lock_after[a][b]){
+    return 1;
+  }
+  for(i=0;i<lock_num;i++){
+    //lock_after[x][x] is never set so the search always ends
+    if(lock_after[a][i] && i!=a && lock_before(i,b)){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//print the name of a lock
+static void lock_print(int id){
+  if(lock_name[id-1]){
+    fprintf(stderr,"%s",lock_name[id-1]);
+  }else{
+    fprintf(stderr,"mutex %p",lock_addr[id-1]);
+  }
+}
+
+//record the order of a lock against the locks that are held, called before waiting for the lock
+static void lock_order(int id){
+  int i,h;
+  for(i=0;i<lock_nheld;i++){
+    h=lock_held[i];
+    //taking a recursive lock again does not wait
+    if(h==id){
+      return;
+    }
+  }
+  for(i=0;i<lock_nheld;i++){
+    h=lock_held[i];
+    //orders that have been seen before don't need to be checked again
+    if(lock_after[h-1][id-1]){
+      continue;
+    }
+    pthread_mutex_lock(&lock_order_lock);
+    if(lock_before(id-1,h-1)){
+      fprintf(stderr,"lock order inversion: ");
+      lock_print(id);
+      fprintf(stderr," taken while holding ");
+      lock_print(h);
+      fprintf(stderr,", the opposite order was seen before\n");
+      abort();
+    }
+    lock_after[h-1][id-1]=1;
+    pthread_mutex_unlock(&lock_order_lock);
+  }
+}
+
+//add a lock to the locks held by the calling thread
+static void lock_push(int id){
+  if(lock_nheld==LOCK_HELD_MAX){
+    fprintf(stderr,"lock order: too many locks held\n");
+    abort();
+  }
+  lock_held[lock_nheld++]=id;
+}
+
+//remove the most recent hold of a lock
+static void lock_pop(int id){
+  int i;
+  for(i=lock_nheld-1;i>=0 && lock_held[i]!=id;i--);
+  if(i<0){
+    fprintf(stderr,"lock order: ");
+    lock_print(id);
+    fprintf(stderr," unlocked but not held\n");
+    abort();
+  }
+  for(;i<lock_nheld-1;i++){
+    lock_held[i]=lock_held[i+1];
+  }
+  lock_nheld--;
+}
+
+//time that the program started
+static struct timespec t0;
+static int t0_set;
+
+//convert CTL time to an absolute time
+static void abstime(CTL_TIME_t t,struct timespec *ts){
+  long long ns=(long long)t0.tv_sec*1000000000LL+t0.tv_nsec+(long long)t*1000000LL;
+  ts->tv_sec=ns/1000000000LL;
+  ts->tv_nsec=ns%1000000000LL;
+}
+
+CTL_TIME_t ctl_get_current_time(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME,&ts);
+  if(!t0_set){
+    t0=ts;
+    t0_set=1;
+  }
+  return (ts.tv_sec-t0.tv_sec)*1000+(ts.tv_nsec-t0.tv_nsec)/1000000;
+}
+
+void ctl_timeout_wait(CTL_TIME_t t){
+  struct timespec ts;
+  abstime(t,&ts);
+  while(clock_nanosleep(CLOCK_REALTIME,TIMER_ABSTIME,&ts,NULL)==EINTR);
+}
+
+int ctl_global_interrupts_set(int en){
+  int prev=irq_en;
+  if(!en && irq_en){
+    pthread_mutex_lock(&irq_lock);
+    irq_en=0;
+  }else if(en && !irq_en){
+    irq_en=1;
+    pthread_mutex_unlock(&irq_lock);
+  }
+  return prev;
+}
+
+void ctl_mutex_init(CTL_MUTEX_t *m){
+  pthread_mutexattr_t a;
+  pthread_mutexattr_init(&a);
+  pthread_mutexattr_settype(&a,PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&m->m,&a);
+  pthread_mutexattr_destroy(&a);
+  m->id=lock_id(m,NULL);
+}
+
+//give a lock a name for lock order messages
+static void lock_set_name(CTL_MUTEX_t *m,const char *name){
+  lock_name[m->id-1]=name;
+}
+
+unsigned ctl_mutex_lock(CTL_MUTEX_t *m,CTL_TIMEOUT_t t,CTL_TIME_t timeout){
+  struct timespec ts;
+  int ret;
+  if(!m->id){
+    m->id=lock_id(m,NULL);
+  }
+  //a lock that does not wait can't deadlock
+  if(t!=CTL_TIMEOUT_NOW){
+    lock_order(m->id);
+  }
+  if(t==CTL_TIMEOUT_NONE || t==CTL_TIMEOUT_INFINITE){
+    ret=pthread_mutex_lock(&m->m);
+  }else if(t==CTL_TIMEOUT_NOW){
+    ret=pthread_mutex_trylock(&m->m);
+  }else{
+    abstime(t==CTL_TIMEOUT_DELAY?ctl_get_current_time()+timeout:timeout,&ts);
+    ret=pthread_mutex_timedlock(&m->m,&ts);
+  }
+  if(ret!=0){
+    return 0;
+  }
+  lock_push(m->id);
+  return 1;
+}
+
+void ctl_mutex_unlock(CTL_MUTEX_t *m){
+  lock_pop(m->id);
+  pthread_mutex_unlock(&m->m);
+}
+
+void ctl_events_init(CTL_EVENT_SET_t *e,CTL_EVENT_SET_t set){
+  pthread_mutex_lock(&ev_lock);
+  *e=set;
+  pthread_mutex_unlock(&ev_lock);
+}
+
+void ctl_events_set_clear(CTL_EVENT_SET_t *e,CTL_EVENT_SET_t set,CTL_EVENT_SET_t clear){
+  pthread_mutex_lock(&ev_lock);
+  *e=(*e|set)&~clear;
+  pthread_cond_broadcast(&ev_cond);
+  pthread_mutex_unlock(&ev_lock);
+}
+
+unsigned ctl_events_wait(CTL_EVENT_WAIT_TYPE_t type,CTL_EVENT_SET_t *e,CTL_EVENT_SET_t mask,CTL_TIMEOUT_t t,CTL_TIME_t timeout){
+  struct timespec ts;
+  unsigned ret=0;
+  int all=(type==CTL_EVENT_WAIT_ALL_EVENTS || type==CTL_EVENT_WAIT_ALL_EVENTS_WITH_AUTO_CLEAR);
+  int clr=(type==CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR || type==CTL_EVENT_WAIT_ALL_EVENTS_WITH_AUTO_CLEAR);
+  if(t==CTL_TIMEOUT_DELAY || t==CTL_TIMEOUT_ABSOLUTE){
+    abstime(t==CTL_TIMEOUT_DELAY?ctl_get_current_time()+timeout:timeout,&ts);
+  }
+  pthread_mutex_lock(&ev_lock);
+  for(;;){
+    if(all?((*e&mask)==mask):(*e&mask)){
+      ret=*e&mask;
+      if(clr){
+        *e&=~ret;
+      }
+      break;
+    }
+    if(t==CTL_TIMEOUT_NOW){
+      break;
+    }
+    if(t==CTL_TIMEOUT_DELAY || t==CTL_TIMEOUT_ABSOLUTE){
+      if(pthread_cond_timedwait(&ev_cond,&ev_lock,&ts)==ETIMEDOUT){
+        break;
+      }
+    }else{
+      pthread_cond_wait(&ev_cond,&ev_lock);
+    }
+  }
+  pthread_mutex_unlock(&ev_lock);
+  return ret;
+}
+
+typedef struct{
+  void (*func)(void*);
+  void *p;
+}TASK_ARG;
+
+static void *task_start(void *arg){
+  TASK_ARG t=*(TASK_ARG*)arg;
+  free(arg);
+  t.func(t.p);
+  return NULL;
+}
+
+void ctl_task_run(CTL_TASK_t *task,unsigned char pri,void (*func)(void*),void *p,const char *name,unsigned stack_size,unsigned *stack,unsigned call_size){
+  TASK_ARG *arg=malloc(sizeof(*arg));
+  arg->func=func;
+  arg->p=p;
+  pthread_create(&task->thread,NULL,task_start,arg);
+  pthread_detach(task->thread);
+}
+
+//=========================[ARCbus]=========================
+
+const SYM_ADDR busAddrSym[]={{"CDH",BUS_ADDR_CDH},{NULL,0}};
+
+const char *I2C_addr_revlookup(unsigned char addr,const SYM_ADDR *syms){
+  for(;syms->name;syms++){
+    if(syms->addr==addr){
+      return syms->name;
+    }
+  }
+  return NULL;
+}
+
+unsigned short mock_timer_read(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (unsigned short)(ts.tv_sec*1000000ULL+ts.tv_nsec/1000);
+}
+
+ticker get_ticker_time(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (ticker)(ts.tv_sec*1024ULL+ts.tv_nsec*1024ULL/1000000000ULL);
+}
+
+//shared bus buffer, can't be taken again by the task that has it
+static unsigned char bus_buf[2048];
+static pthread_mutex_t bus_lock=PTHREAD_MUTEX_INITIALIZER;
+static int bus_lock_id;
+
+unsigned long mock_bus_fail;
+
+unsigned char *BUS_get_buffer(CTL_TIMEOUT_t t,CTL_TIME_t timeout){
+  //act like the buffer was not freed before the timeout
+  if(mock_bus_fail){
+    mock_bus_fail--;
+    return NULL;
+  }
+  if(!bus_lock_id){
+    bus_lock_id=lock_id(&bus_lock,"bus buffer");
+  }
+  lock_order(bus_lock_id);
+  pthread_mutex_lock(&bus_lock);
+  lock_push(bus_lock_id);
+  return bus_buf;
+}
+
+void BUS_free_buffer(void){
+  lock_pop(bus_lock_id);
+  pthread_mutex_unlock(&bus_lock);
+}
+
+unsigned long mock_spi_tx;
+unsigned long mock_spi_busy;
+void (*mock_spi_hook)(unsigned char addr,const unsigned char *dat,unsigned short len);
+
+int BUS_SPI_txrx(unsigned char addr,unsigned char *tx,unsigned char *rx,unsigned short len){
+  if(mock_spi_busy){
+    mock_spi_busy--;
+    return ERR_BUSY;
+  }
+  mock_spi_tx++;
+  if(mock_spi_hook){
+    mock_spi_hook(addr,tx,len);
+  }
+  return RET_SUCCESS;
+}
+
+//=========================[SD card]=========================
+
+unsigned char *mock_sd;
+unsigned long mock_sd_blocks;
+unsigned long mock_sd_reads,mock_sd_writes,mock_sd_last;
+__thread unsigned long mock_sd_thread_reads,mock_sd_thread_cmds;
+unsigned long mock_sd_write_us;
+unsigned long mock_sd_cmds,mock_sd_cmd_us;
+
+//held while the card is used, recursive so that reads and writes can be done with the card locked
+static CTL_MUTEX_t sd_lock;
+
+void mock_sd_init(unsigned long blocks){
+  if(mock_sd){
+    munmap(mock_sd,mock_sd_blocks*512);
+  }
+  mock_sd=mmap(NULL,blocks*512,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if(mock_sd==MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
+  mock_sd_blocks=blocks;
+  ctl_mutex_init(&sd_lock);
+  lock_set_name(&sd_lock,"SD card");
+  mock_sd_reads=mock_sd_writes=mock_sd_last=mock_sd_cmds=0;
+}
+
+//count a command and wait for the command overhead
+static void sd_cmd(void){
+  struct timespec ts,end;
+  mock_sd_cmds++;
+  mock_sd_thread_cmds++;
+  if(mock_sd_cmd_us){
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    end.tv_nsec+=mock_sd_cmd_us*1000;
+    end.tv_sec+=end.tv_nsec/1000000000;
+    end.tv_nsec%=1000000000;
+    do{
+      clock_gettime(CLOCK_MONOTONIC,&ts);
+    }while(ts.tv_sec<end.tv_sec || (ts.tv_sec==end.tv_sec && ts.tv_nsec<end.tv_nsec));
+  }
+}
+
+int mmcInit_card(void){
+  return mock_sd?MMC_SUCCESS:MMC_INIT_ERROR;
+}
+
+int mmcLock(CTL_TIMEOUT_t t,CTL_TIME_t timeout){
+  return ctl_mutex_lock(&sd_lock,t,timeout)?MMC_SUCCESS:MMC_LOCK_TIMEOUT_ERROR;
+}
+
+void mmcUnlock(void){
+  ctl_mutex_unlock(&sd_lock);
+}
+
+int mmcReadBlocks(SD_block_addr addr,unsigned short count,unsigned char *buf){
+  if(addr+count>mock_sd_blocks){
+    return MMC_ADDRESS_ERROR;
+  }
+  //transfers lock the card like the SD card library does
+  mmcLock(CTL_TIMEOUT_NONE,0);
+  sd_cmd();
+  mock_sd_reads+=count;
+  mock_sd_thread_reads+=count;
+  memcpy(buf,mock_sd+addr*512,count*512);
+  mmcUnlock();
+  return MMC_SUCCESS;
+}
+
+int mmcReadBlock(SD_block_addr addr,unsigned char *buf){
+  return mmcReadBlocks(addr,1,buf);
+}
+
+int mmcWriteMultiBlock(SD_block_addr addr,const unsigned char *buf,unsigned short count){
+  if(addr+count>mock_sd_blocks){
+    return MMC_ADDRESS_ERROR;
+  }
+  mmcLock(CTL_TIMEOUT_NONE,0);
+  sd_cmd();
+  mock_sd_writes+=count;
+  mock_sd_last=addr+count-1;
+  //take as long as a real card
+  if(mock_sd_write_us){
+    usleep(mock_sd_write_us*count);
+  }
+  memcpy(mock_sd+addr*512,buf,count*512);
+  mmcUnlock();
+  return MMC_SUCCESS;
+}
+
+int mmcWriteBlock(SD_block_addr addr,const unsigned char *buf){
+  return mmcWriteMultiBlock(addr,buf,1);
+}
+
+int mmcErase(SD_block_addr start,SD_block_addr end){
+  if(start>end || end>=mock_sd_blocks){
+    return MMC_ADDRESS_ERROR;
+  }
+  mmcLock(CTL_TIMEOUT_NONE,0);
+  memset(mock_sd+start*512,0,(end-start+1)*512);
+  mmcUnlock();
+  return MMC_SUCCESS;
+}
+
+const char *SD_error_str(int error){
+  switch(error){
+    case MMC_SUCCESS:
+      return "Success";
+    case MMC_INIT_ERROR:
+      return "Init Error";
+    case MMC_ADDRESS_ERROR:
+      return "Address Error";
+    default:
+      return "Unknown Error";
+  }
+}
@@ -0,0 +1,32 @@
+//counters and controls for the host stand-ins
+#ifndef __MOCK_H
+#define __MOCK_H
+
+//in memory SD card, shared between processes so that a child can start from a card written by another
+extern unsigned char *mock_sd;
+extern unsigned long mock_sd_blocks;
+//SD card blocks read and written
+extern unsigned long mock_sd_reads,mock_sd_writes;
+//SD card blocks read and commands sent by the calling thread, the library tasks also use the card
+extern __thread unsigned long mock_sd_thread_reads,mock_sd_thread_cmds;
+//address of the last block written
+extern unsigned long mock_sd_last;
+//time in us that each block write takes
+extern unsigned long mock_sd_write_us;
+//SD card commands, a multiple block transfer is one command
+extern unsigned long mock_sd_cmds;
+//time in us of overhead for each command
+extern unsigned long mock_sd_cmd_us;
+//number of calls to BUS_get_buffer that fail because the buffer is in use
+extern unsigned long mock_bus_fail;
+//number of SPI transactions
+extern unsigned long mock_spi_tx;
+//number of SPI transactions that fail because the bus is busy
+extern unsigned long mock_spi_busy;
+//called for each SPI transaction if set
+extern void (*mock_spi_hook)(unsigned char addr,const unsigned char *dat,unsigned short len);
+
+//create an empty SD card with the given number of blocks
+void mock_sd_init(unsigned long blocks);
+
+#endif